@@ -0,0 +1,153 @@
+/* Test using libdebugedit contexts from different threads at once.
+   Copyright (C) 2024 Mark J. Wielaard <mark@klomp.org>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.  */
+
+/* Usage: libdebugedit-threads BASE DEST BAD FILE...
+
+   Edits each FILE in a thread of its own, all at the same time, each
+   with its own context rewriting BASE into DEST and recomputing the
+   build ID.  Then each context edits BAD, which must fail with an
+   error message, and FILE again, which must then need no changes.
+   Prints the results and build ID of each FILE in order.  Exits with
+   status 1 when something unexpected happened.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libdebugedit.h"
+
+static const char *base_dir;
+static const char *dest_dir;
+static const char *bad_file;
+static pthread_barrier_t barrier;
+
+struct job
+{
+  pthread_t thread;
+  const char *file;
+  int edited, bad, again;
+  char *errmsg;
+  char build_id[64 * 2 + 1];
+  bool failed;
+};
+
+static void *
+run_job (void *arg)
+{
+  struct job *job = arg;
+  struct debugedit_options opts;
+  char *errmsg;
+
+  debugedit_options_init (&opts);
+  opts.base_dir = base_dir;
+  opts.dest_dir = dest_dir;
+  opts.build_id = true;
+  debugedit *ctx = debugedit_begin (&opts, &errmsg);
+  if (ctx == NULL)
+    {
+      fprintf (stderr, "%s: %s\n", job->file,
+	       errmsg != NULL ? errmsg : "out of memory");
+      free (errmsg);
+      job->failed = true;
+      pthread_barrier_wait (&barrier);
+      return NULL;
+    }
+
+  /* Make sure the files really are edited at the same time.  */
+  pthread_barrier_wait (&barrier);
+  job->edited = debugedit_edit (ctx, job->file);
+  if (job->edited < 0)
+    fprintf (stderr, "%s: %s\n", job->file, debugedit_errmsg (ctx));
+
+  size_t size;
+  const unsigned char *id = debugedit_build_id (ctx, 0, &size);
+  for (size_t i = 0; id != NULL && i < size && i < 64; i++)
+    sprintf (job->build_id + 2 * i, "%02x", id[i]);
+
+  job->bad = debugedit_edit (ctx, bad_file);
+  if (debugedit_errmsg (ctx) != NULL)
+    job->errmsg = strdup (debugedit_errmsg (ctx));
+
+  job->again = debugedit_edit (ctx, job->file);
+  if (job->again < 0)
+    fprintf (stderr, "%s: %s\n", job->file, debugedit_errmsg (ctx));
+
+  debugedit_end (ctx);
+  return NULL;
+}
+
+int
+main (int argc, char **argv)
+{
+  if (argc < 5)
+    {
+      fprintf (stderr, "Usage: %s BASE DEST BAD FILE...\n", argv[0]);
+      return 1;
+    }
+  base_dir = argv[1];
+  dest_dir = argv[2];
+  bad_file = argv[3];
+  int njobs = argc - 4;
+
+  struct job *jobs = calloc (njobs, sizeof (struct job));
+  if (jobs == NULL
+      || pthread_barrier_init (&barrier, NULL, njobs) != 0)
+    {
+      perror ("libdebugedit-threads");
+      return 1;
+    }
+  for (int i = 0; i < njobs; i++)
+    {
+      jobs[i].file = argv[4 + i];
+      if (pthread_create (&jobs[i].thread, NULL, run_job, &jobs[i]) != 0)
+	{
+	  perror ("libdebugedit-threads");
+	  return 1;
+	}
+    }
+
+  int status = 0;
+  for (int i = 0; i < njobs; i++)
+    {
+      struct job *job = &jobs[i];
+      pthread_join (job->thread, NULL);
+      if (job->failed)
+	{
+	  status = 1;
+	  continue;
+	}
+      printf ("%s: %d %d %d %s\n", job->file, job->edited, job->bad,
+	      job->again, job->build_id);
+      if (job->bad != -1 || job->errmsg == NULL)
+	{
+	  fprintf (stderr, "%s: no error for %s\n", job->file, bad_file);
+	  status = 1;
+	}
+      else
+	fprintf (stderr, "%s\n", job->errmsg);
+      free (job->errmsg);
+    }
+
+  pthread_barrier_destroy (&barrier);
+  free (jobs);
+  return status;
+}
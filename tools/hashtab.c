@@ -204,24 +204,27 @@ eq_pointer (const PTR p1, const PTR p2)
 /* The parens around the function names in the next two definitions
    are essential in order to prevent macro expansions of the name.
    The bodies, however, are expanded as expected, so they are not
-   recursive definitions.  */
+   recursive definitions.  The names are spelled out with the prefix
+   hashtab.h gives them, as the macros replace its renames.  */
 
 /* Return the current size of given hash table.  */
 
+#undef htab_size
 #define htab_size(htab)  ((htab)->size)
 
 size_t
-(htab_size) (htab_t htab)
+(debugedit_htab_size) (htab_t htab)
 {
   return htab_size (htab);
 }
 
 /* Return the current number of elements in given hash table. */
 
+#undef htab_elements
 #define htab_elements(htab)  ((htab)->n_elements - (htab)->n_deleted)
 
 size_t
-(htab_elements) (htab_t htab)
+(debugedit_htab_elements) (htab_t htab)
 {
   return htab_elements (htab);
 }
@@ -38,6 +38,33 @@ extern "C" {
 
 #include "ansidecl.h"
 
+/* This copy is part of the installed libdebugedit.a, keep its symbols
+   apart from the libiberty ones a program using it might also link.  */
+#define htab_create_alloc debugedit_htab_create_alloc
+#define htab_create_alloc_ex debugedit_htab_create_alloc_ex
+#define htab_create_typed_alloc debugedit_htab_create_typed_alloc
+#define htab_create debugedit_htab_create
+#define htab_try_create debugedit_htab_try_create
+#define htab_set_functions_ex debugedit_htab_set_functions_ex
+#define htab_delete debugedit_htab_delete
+#define htab_empty debugedit_htab_empty
+#define htab_find debugedit_htab_find
+#define htab_find_slot debugedit_htab_find_slot
+#define htab_find_with_hash debugedit_htab_find_with_hash
+#define htab_find_slot_with_hash debugedit_htab_find_slot_with_hash
+#define htab_clear_slot debugedit_htab_clear_slot
+#define htab_remove_elt debugedit_htab_remove_elt
+#define htab_remove_elt_with_hash debugedit_htab_remove_elt_with_hash
+#define htab_traverse debugedit_htab_traverse
+#define htab_traverse_noresize debugedit_htab_traverse_noresize
+#define htab_size debugedit_htab_size
+#define htab_elements debugedit_htab_elements
+#define htab_collisions debugedit_htab_collisions
+#define htab_hash_pointer debugedit_htab_hash_pointer
+#define htab_eq_pointer debugedit_htab_eq_pointer
+#define htab_hash_string debugedit_htab_hash_string
+#define iterative_hash debugedit_iterative_hash
+
 /* The type for a hash code.  */
 typedef unsigned int hashval_t;
 
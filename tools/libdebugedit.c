@@ -0,0 +1,8511 @@
+/* Copyright (C) 2001-2003, 2005, 2007, 2009-2011, 2016, 2017 Red Hat, Inc.
+   Copyright (C) 2022, 2023, 2024 Mark J. Wielaard <mark@klomp.org>
+   Written by Alexander Larsson <alexl@redhat.com>, 2002
+   Based on code by Jakub Jelinek <jakub@redhat.com>, 2001.
+   String/Line table rewriting by Mark Wielaard <mjw@redhat.com>, 2017.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <byteswap.h>
+#include <endian.h>
+#include <errno.h>
+#include <error.h>
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <ar.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_XATTR_H
+#include <sys/xattr.h>
+#endif
+#include <fcntl.h>
+#include <getopt.h>
+
+#include <gelf.h>
+#include <dwarf.h>
+#include <libelf.h>
+
+#ifndef MAX
+#define MAX(m, n) ((m) < (n) ? (n) : (m))
+#endif
+#ifndef MIN
+#define MIN(m, n) ((m) > (n) ? (n) : (m))
+#endif
+
+
+/* Unfortunately strtab manipulation functions were only officially added
+   to elfutils libdw in 0.167.  Before that there were internal unsupported
+   ebl variants.  While libebl.h isn't supported we'll try to use it anyway
+   if the elfutils we build against is too old.  */
+#include <elfutils/version.h>
+#if _ELFUTILS_PREREQ (0, 167)
+#include <elfutils/libdwelf.h>
+typedef Dwelf_Strent		Strent;
+typedef Dwelf_Strtab		Strtab;
+#define strtab_init		dwelf_strtab_init
+#define strtab_add(X,Y)		dwelf_strtab_add(X,Y)
+#define strtab_add_len(X,Y,Z)	dwelf_strtab_add_len(X,Y,Z)
+#define strtab_free		dwelf_strtab_free
+#define strtab_finalize		dwelf_strtab_finalize
+#define strent_offset		dwelf_strent_off
+#else
+#include <elfutils/libebl.h>
+typedef struct Ebl_Strent	Strent;
+typedef struct Ebl_Strtab	Strtab;
+#define strtab_init		ebl_strtabinit
+#define strtab_add(X,Y)		ebl_strtabadd(X,Y,0)
+#define strtab_add_len(X,Y,Z)	ebl_strtabadd(X,Y,Z)
+#define strtab_free		ebl_strtabfree
+#define strtab_finalize		ebl_strtabfinalize
+#define strent_offset		ebl_strtaboffset
+#endif
+
+#include <search.h>
+
+#include "tools/hashtab.h"
+#include "tools/libdebugedit.h"
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#ifndef ELFCOMPRESS_ZSTD
+#define ELFCOMPRESS_ZSTD 2
+#endif
+
+#define DW_TAG_partial_unit 0x3c
+#define DW_FORM_sec_offset 0x17
+#define DW_FORM_exprloc 0x18
+#define DW_FORM_flag_present 0x19
+#define DW_FORM_ref_sig8 0x20
+
+/* The settings of the debugedit context being used on this thread,
+   see load_context.  Each thread can edit a file with a different
+   context at the same time, so all (per file) state below is thread
+   local.  */
+static __thread char *base_dir = NULL;
+static __thread char *dest_dir = NULL;
+/* The paths to rewrite, see find_prefix_map.  NULL when no paths get
+   rewritten.  */
+static __thread const struct prefix_node *prefix_maps = NULL;
+static __thread char *list_file = NULL;
+static __thread int list_file_fd = -1;
+static __thread char *list_index = NULL;
+static __thread int do_build_id = 0;
+static __thread int no_recompute_build_id = 0;
+static __thread char *build_id_seed = NULL;
+/* Whether to compute the build-id as a hash over independently
+   hashed section chunks (--build-id-mode=tree) instead of hashing
+   everything as one stream.  */
+static __thread int build_id_tree = 0;
+
+/* Set when nothing but the build-id will be (re)computed, so the
+   section data doesn't need to go through libelf.  */
+static __thread bool build_id_only = false;
+
+/* Compression type (ELFCOMPRESS_ZLIB, ELFCOMPRESS_ZSTD or zero for
+   none) to write debug sections out with, or -1 to keep the
+   compression type each section had in the input file.  */
+static __thread int compress_type = -1;
+/* Compression level to use, or -1 to use the compressor default.  */
+static __thread int compress_level = -1;
+/* Whether to also compress debug sections that weren't compressed in
+   the input file (only when compress_type is given).  */
+static __thread int compress_all = 0;
+/* Maximum number of threads to use.  */
+static __thread int jobs = 1;
+/* Rough bound on the memory to use for reading the DWARF data of big
+   inputs (--memory-limit), zero for no bound.  Files that are written
+   still need all their debug sections in memory.  */
+static __thread size_t memory_limit = 0;
+
+/* The context used by debugedit_begin or debugedit_edit on this
+   thread.  */
+static __thread struct debugedit *cur_ctx;
+
+/* All errors and warnings are reported through the context, a fatal
+   error (nonzero STATUS) unwinds back to the debugedit_begin or
+   debugedit_edit call instead of exiting.  */
+static void report_error (int status, int errnum, const char *fmt, ...)
+  __attribute__ ((format (printf, 3, 4)));
+#define error(status, errnum, ...) \
+  report_error (status, errnum, __VA_ARGS__)
+
+/* We go over the debug sections in two phases. In phase zero we keep
+   track of any needed changes and collect strings, indexes and
+   sizes. In phase one we do the actual replacements updating the
+   strings, indexes and writing out new debug sections. The following
+   keep track of various changes that might be needed. */
+
+/* Whether we need to do any literal string (DW_FORM_string) replacements
+   in debug_info. */
+static __thread bool need_string_replacement = false;
+/* Whether we need to do any updates of the string indexes (DW_FORM_strp)
+   in debug_info for string indexes. */
+static __thread bool need_strp_update = false;
+/* Likewise for DW_FORM_line_strp. */
+static __thread bool need_line_strp_update = false;
+/* If the debug_line changes size we will need to update the
+   DW_AT_stmt_list attributes indexes in the debug_info. */
+static __thread bool need_stmt_update = false;
+
+/* If we recompress any debug section we need to write out the ELF
+   again. */
+static __thread bool recompressed = false;
+
+/* Set while only working out what would change, see debugedit_check.
+   Nothing is written then and the DIE walk stops as soon as any path
+   is known to change.  */
+static __thread struct debugedit_check *check_result = NULL;
+
+/* Whether phase zero found any paths that need rewriting.  */
+static bool
+paths_changed (void)
+{
+  return (need_string_replacement || need_strp_update
+	  || need_line_strp_update || need_stmt_update);
+}
+
+/* Storage for dynamically allocated strings to put into string
+   table. Keep together in memory blocks of 16K. */
+#define STRMEMSIZE (16 * 1024)
+struct strmemblock
+{
+  struct strmemblock *next;
+  char memory[0];
+};
+
+/* We keep track of each index in the original string table and the
+   associated entry in the new table so we don't insert identical
+   strings into the new string table. If constructed correctly the
+   original strtab shouldn't contain duplicate strings anyway. Any
+   actual identical strings could be deduplicated, but searching for
+   and comparing the indexes is much faster than comparing strings
+   (and we don't have to construct replacement strings). */
+struct stridxentry
+{
+  size_t idx; /* Original index in the string table. */
+  Strent *entry; /* Entry in the new table. */
+};
+
+/* Storage for new string table entries. Keep together in memory to
+   quickly search through them with tsearch. */
+#define STRIDXENTRIES ((16 * 1024) / sizeof (struct stridxentry))
+struct strentblock
+{
+  struct strentblock *next;
+  struct stridxentry entry[0];
+};
+
+/* Maps an index in the original string table to the offset of the
+   same string in the new string table.  */
+struct stroff
+{
+  size_t old_idx;
+  size_t new_idx;
+};
+
+/* All data to keep track of the existing and new string table. */
+struct strings
+{
+  Strtab *str_tab;			/* The new string table. */
+  char *str_buf;			/* New Elf_Data d_buf. */
+  struct strmemblock *blocks;		/* The first strmemblock. */
+  struct strmemblock *last_block;	/* The currently used strmemblock. */
+  size_t stridx;			/* Next free byte in last block. */
+  struct strentblock *entries;		/* The first string index block. */
+  struct strentblock *last_entries;	/* The currently used strentblock. */
+  size_t entryidx;			/* Next free entry in the last block. */
+  void *strent_root;			/* strent binary search tree root. */
+  struct stroff *offs;			/* Sorted map, see compact_strings. */
+  size_t noffs;				/* Number of entries in offs. */
+  size_t offs_map_size;			/* Mapped size of offs, or zero. */
+};
+
+struct line_table
+{
+  struct CU *cu;      /* (first) CU that references this table.  */
+
+  size_t old_idx;     /* Original offset. */
+  size_t new_idx;     /* Offset in new debug_line section. */
+  ssize_t size_diff;  /* Difference in (header) size. */
+  bool replace_dirs;  /* Whether to replace any dir paths.  */
+  bool replace_files; /* Whether to replace any file paths. */
+
+  /* Header fields. */
+  uint8_t offset_size; /* 4 for 32-bit DWARF, 8 for 64-bit DWARF.  */
+  uint64_t unit_length;
+  uint16_t version;
+  uint64_t header_length;
+  uint8_t min_instr_len;
+  uint8_t max_op_per_instr; /* Only if version >= 4 */
+  uint8_t default_is_stmt;
+  int8_t line_base;
+  uint8_t line_range;
+  uint8_t opcode_base;
+};
+
+struct debug_lines
+{
+  struct line_table *table; /* Malloc/Realloced. */
+  size_t size;              /* Total number of line_tables.
+			       Updated by get_line_table. */
+  size_t used;              /* Used number of line_tables.
+			       Updated by get_line_table. */
+  size_t debug_lines_len;   /* Total size of new debug_line section.
+			       updated by edit_dwarf2_line. */
+  char *line_buf;           /* New Elf_Data d_buf. */
+};
+
+/* Bump allocator for the many small objects the DWARF walk needs,
+   like the strmemblocks for new strings.  Objects aren't freed one by
+   one.  arena_release drops everything allocated since an arena_mark
+   and destroy_arena frees it all.  */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+struct arena_block
+{
+  struct arena_block *prev;
+  size_t size;				/* Usable bytes in memory. */
+  size_t used;				/* Next free byte in memory. */
+  max_align_t memory[];
+};
+
+struct arena
+{
+  struct arena_block *block;		/* The currently used block. */
+};
+
+struct arena_mark
+{
+  struct arena_block *block;
+  size_t used;
+};
+
+/* Where the parts of one unit of a .dwp file are in the sections
+   shared by all units.  */
+struct unit_contrib
+{
+  size_t info_offs;
+  size_t abbrev_offs;
+  size_t line_offs;
+  size_t str_offsets_offs;
+  size_t macro_offs;
+};
+
+struct CU
+{
+  int ptr_size;
+  int cu_version;
+  /* 4 for 32-bit DWARF, 8 for 64-bit DWARF.  */
+  int offset_size;
+  /* The offset into the .debug_str_offsets section for this CU.  */
+  size_t str_offsets_base;
+  /* The offset into the .debug_macros section for this CU (DW_AT_macros).  */
+  size_t macros_offs;
+  /* Whether this is a split unit (in a .dwo or .dwp file).  */
+  bool split;
+  /* Split units have no DW_AT_stmt_list, their line table is at
+     LINE_BASE.  Their DW_AT_macros is relative to MACRO_BASE.
+     IMPLICIT_LINE is set until the line table has been read.  */
+  bool implicit_line;
+  size_t line_base;
+  size_t macro_base;
+
+  struct CU *next;
+};
+
+typedef struct
+{
+  Elf *elf;
+  GElf_Ehdr ehdr;
+  Elf_Scn **scn;
+  const char *filename;
+  int lastscn;
+  size_t phnum;
+  struct strings debug_str, debug_line_str;
+  struct debug_lines lines;
+  /* List of CUs that keeps track of version, ptr_size,
+     str_offsets_base, etc. so other structures, like macros, can use
+     those properties for parsing.  */
+  struct CU *cus;
+  /* Holds the CUs above and scratch memory used while walking the
+     DWARF.  */
+  struct arena arena;
+  /* Section data buffers we allocated ourselves (for sections we
+     compressed without libelf), indexed by section number.  */
+  void **scn_bufs;
+  /* Build-id hashing of the unchanged sections running in the
+     background, see start_build_id_hash.  */
+  struct build_id_hash *build_id_hash;
+  /* Memo of base_dir prefix matches, see lookup_dir_prefix.  */
+  htab_t dir_prefixes;
+  /* One bit per symbol of section rel_symtab, set when setup_relbuf
+     should keep relocations against it.  */
+  unsigned char *rel_syms;
+  size_t rel_nsyms;
+  int rel_symtab;
+  /* The whole (host byte order) file as mapped by libelf when only
+     the build-id is (re)computed, see build_id_section_data.  */
+  const unsigned char *rawfile;
+  /* A copy of the build-id note section rawnote_scn from rawfile with
+     the build-id bits cleared, hashed instead of the mapped bytes.  */
+  unsigned char *rawnote;
+  int rawnote_scn;
+  /* The file descriptor the ELF file was opened from.  */
+  int fd;
+  /* The unit contributions of a .dwp file from its .debug_cu_index
+     and .debug_tu_index, sorted by info_offs, see read_unit_index.  */
+  struct unit_contrib *contribs;
+  size_t ncontribs;
+  GElf_Shdr shdr[0];
+} DSO;
+
+/* A --prefix-map OLD=NEW, the -b and -d pair is one too.  Both paths
+   are canonicalized.  */
+struct prefix_map
+{
+  char *old;
+  char *new;
+  size_t new_len;
+};
+
+/* The prefix maps are compiled into a trie of path components, so all
+   can be matched in one walk over a path, see find_prefix_map.  The
+   root node has an empty name, its children are the first components
+   (the empty string for absolute paths).  */
+struct prefix_node
+{
+  /* The component, not zero terminated, points into the old path of
+     a prefix map.  */
+  const char *name;
+  size_t len;
+  /* The map whose old path ends with this component, or NULL.  */
+  const struct prefix_map *map;
+  struct prefix_node *children;
+  struct prefix_node *next;
+};
+
+/* A debugedit context, see libdebugedit.h.  load_context sets up the
+   thread local settings and state from it.  */
+struct debugedit
+{
+  struct debugedit_options opts;
+  /* Our own copies of the option strings, the paths canonicalized.  */
+  char *base_dir;
+  char *dest_dir;
+  char *list_file;
+  char *list_index;
+  char *build_id_seed;
+  int list_file_fd;
+  int list_index_fd;
+
+  /* The -b and -d pair followed by all prefix_maps options, and the
+     trie of all (NULL if there are none).  */
+  struct prefix_map *prefix_maps;
+  size_t nprefix_maps;
+  struct prefix_node *prefix_trie;
+
+  /* The source files and list file entries already seen, kept from
+     file to file by save_context.  */
+  htab_t source_files;
+  htab_t list_file_names;
+  char *list_file_buf;
+  size_t list_file_buf_len;
+  struct list_index_header *list_index_map;
+  size_t list_index_map_size;
+
+  /* The build-ids of the last edited file (or archive members), one
+     after the other.  build_id_ends has the end offset of each.  */
+  unsigned char *build_ids;
+  size_t *build_id_ends;
+  size_t nbuild_ids;
+
+  /* The cache_dir option, see cache_lookup.  While editing a file for
+     the cache its list file entries are captured.  */
+  char *cache_dir;
+  bool capturing;
+  char *list_capture;
+  size_t list_capture_len;
+  size_t list_capture_size;
+  htab_t saved_source_files;
+
+  /* The error message of the last failed call.  */
+  char *errmsg;
+  /* Whether the warning that the memory_limit option doesn't bound
+     editing was given.  */
+  bool memory_limit_warned;
+
+  /* Where report_error unwinds to on a fatal error and the Elf and DSO
+     being edited, which are freed then.  */
+  jmp_buf unwind;
+  Elf *elf;
+  DSO *dso;
+  /* What else the functions being unwound through hold, released then
+     too, see push_cleanup.  */
+  struct cleanup *cleanups;
+  size_t ncleanups;
+  size_t cleanups_size;
+};
+
+/* A resource to release when unwinding from a fatal error, by calling
+   FN with PTR and SIZE.  */
+struct cleanup
+{
+  void (*fn) (void *ptr, size_t size);
+  void *ptr;
+  size_t size;
+};
+
+static void
+report_error (int status, int errnum, const char *fmt, ...)
+{
+  struct debugedit *ctx = cur_ctx;
+  char *msg;
+  va_list ap;
+
+  va_start (ap, fmt);
+  if (vasprintf (&msg, fmt, ap) < 0)
+    msg = NULL;
+  va_end (ap);
+
+  if (msg != NULL && errnum != 0)
+    {
+      char buf[128];
+      char *m;
+      if (asprintf (&m, "%s: %s", msg,
+		    strerror_r (errnum, buf, sizeof buf)) < 0)
+	m = NULL;
+      free (msg);
+      msg = m;
+    }
+
+  /* Not called on behalf of a context, like from a helper thread.
+     There is nothing to unwind to then, but the library should never
+     end the process, so only warn.  Helper threads don't call error
+     with a non-zero STATUS.  */
+  if (ctx == NULL)
+    {
+      (error) (0, 0, "%s", msg ?: "Out of memory");
+      free (msg);
+      return;
+    }
+
+  if (status == 0)
+    {
+      if (ctx->opts.warn != NULL)
+	ctx->opts.warn (msg ?: "Out of memory", ctx->opts.warn_arg);
+      free (msg);
+      return;
+    }
+
+  free (ctx->errmsg);
+  ctx->errmsg = msg;
+  longjmp (ctx->unwind, 1);
+}
+
+/* Makes sure FN is called with PTR and SIZE when a fatal error unwinds
+   through the caller, to release a resource it holds.  The resource
+   cannot be on the stack, that is gone by then.  Returns the index of
+   the cleanup for set_cleanup.  Once the caller released the resource
+   itself it forgets the cleanup with drop_cleanups.  */
+static size_t
+push_cleanup (void (*fn) (void *, size_t), void *ptr, size_t size)
+{
+  struct debugedit *ctx = cur_ctx;
+  if (ctx->ncleanups == ctx->cleanups_size)
+    {
+      size_t n = ctx->cleanups_size == 0 ? 16 : 2 * ctx->cleanups_size;
+      struct cleanup *cleanups = realloc (ctx->cleanups,
+					  n * sizeof (struct cleanup));
+      if (cleanups == NULL)
+	{
+	  fn (ptr, size);
+	  error (1, ENOMEM, "Couldn't allocate cleanup");
+	}
+      ctx->cleanups = cleanups;
+      ctx->cleanups_size = n;
+    }
+  ctx->cleanups[ctx->ncleanups].fn = fn;
+  ctx->cleanups[ctx->ncleanups].ptr = ptr;
+  ctx->cleanups[ctx->ncleanups].size = size;
+  return ctx->ncleanups++;
+}
+
+/* Changes the resource released by cleanup N, like after a realloc.
+   A NULL PTR makes the cleanup do nothing for the cleanup_ functions
+   taking a pointer.  */
+static void
+set_cleanup (size_t n, void *ptr, size_t size)
+{
+  cur_ctx->cleanups[n].ptr = ptr;
+  cur_ctx->cleanups[n].size = size;
+}
+
+/* Returns the mark to pass to drop_cleanups to forget the cleanups
+   pushed from now on.  */
+static size_t
+cleanups_mark (void)
+{
+  return cur_ctx->ncleanups;
+}
+
+/* Forgets the cleanups pushed since MARK, the caller released their
+   resources.  */
+static void
+drop_cleanups (size_t mark)
+{
+  assert (mark <= cur_ctx->ncleanups);
+  cur_ctx->ncleanups = mark;
+}
+
+/* Releases the resources of all cleanups of CTX, last pushed first.  */
+static void
+run_cleanups (struct debugedit *ctx)
+{
+  while (ctx->ncleanups > 0)
+    {
+      struct cleanup *c = &ctx->cleanups[--ctx->ncleanups];
+      c->fn (c->ptr, c->size);
+    }
+}
+
+static void
+cleanup_free (void *ptr, size_t size __attribute__ ((unused)))
+{
+  free (ptr);
+}
+
+static void
+cleanup_close (void *ptr __attribute__ ((unused)), size_t fd)
+{
+  close ((int) fd);
+}
+
+static void
+cleanup_munmap (void *ptr, size_t size)
+{
+  if (ptr != NULL)
+    munmap (ptr, size);
+}
+
+static void
+cleanup_elf_end (void *elf, size_t size __attribute__ ((unused)))
+{
+  elf_end (elf);
+}
+
+/* Removes the file NAME, a malloced string, and frees NAME.  */
+static void
+cleanup_unlink (void *name, size_t size __attribute__ ((unused)))
+{
+  unlink (name);
+  free (name);
+}
+
+static void
+cleanup_xxh3_state (void *state, size_t size __attribute__ ((unused)))
+{
+  XXH3_freeState (state);
+}
+
+static void
+cleanup_htab_delete (void *htab, size_t size __attribute__ ((unused)))
+{
+  htab_delete (htab);
+}
+
+typedef struct
+{
+  unsigned char *ptr;
+  uint32_t addend;
+  int ndx;
+} REL;
+
+typedef struct
+{
+  Elf64_Addr r_offset;
+  int ndx;
+} LINE_REL;
+
+typedef struct debug_section
+  {
+    const char *name;
+    unsigned char *data;
+    Elf_Data *elf_data;
+    size_t size;
+    int sec, relsec;
+    int reltype;
+    REL *relbuf;
+    REL *relend;
+    /* Result of the previous find_rel_for_ptr lookup.  */
+    REL *relcur;
+    bool rel_updated;
+    uint32_t ch_type;
+    /* With a memory_limit .debug_info and .debug_types are read in
+       phase 0 through a private file mapping of MAP_SIZE bytes at MAP
+       instead of through libelf, see map_debug_section.  The pages
+       before MAP_RELEASED have already been given back.  */
+    unsigned char *map;
+    size_t map_size;
+    unsigned char *map_released;
+    /* Only happens for COMDAT .debug_macro, .debug_types and
+       .debug_info.  */
+    struct debug_section *next;
+  } debug_section;
+
+static __thread debug_section debug_sections[] =
+  {
+#define DEBUG_INFO	0
+#define DEBUG_ABBREV	1
+#define DEBUG_LINE	2
+#define DEBUG_ARANGES	3
+#define DEBUG_PUBNAMES	4
+#define DEBUG_PUBTYPES	5
+#define DEBUG_MACINFO	6
+#define DEBUG_LOC	7
+#define DEBUG_STR	8
+#define DEBUG_FRAME	9
+#define DEBUG_RANGES	10
+#define DEBUG_TYPES	11
+#define DEBUG_MACRO	12
+#define DEBUG_GDB_SCRIPT	13
+#define DEBUG_RNGLISTS	14
+#define DEBUG_LINE_STR	15
+#define DEBUG_ADDR	16
+#define DEBUG_STR_OFFSETS	17
+#define DEBUG_LOCLISTS	18
+#define DEBUG_CU_INDEX	19
+#define DEBUG_TU_INDEX	20
+#define DEBUG_GNU_PUBNAMES	21
+#define DEBUG_GNU_PUBTYPES	22
+    { ".debug_info",		},
+    { ".debug_abbrev",		},
+    { ".debug_line",		},
+    { ".debug_aranges",		},
+    { ".debug_pubnames",	},
+    { ".debug_pubtypes",	},
+    { ".debug_macinfo",		},
+    { ".debug_loc",		},
+    { ".debug_str",		},
+    { ".debug_frame",		},
+    { ".debug_ranges",		},
+    { ".debug_types",		},
+    { ".debug_macro",		},
+    { ".debug_gdb_scripts",	},
+    { ".debug_rnglists",	},
+    { ".debug_line_str",	},
+    { ".debug_addr",		},
+    { ".debug_str_offsets",	},
+    { ".debug_loclists",	},
+    { ".debug_cu_index",	},
+    { ".debug_tu_index",	},
+    { ".debug_gnu_pubnames",	},
+    { ".debug_gnu_pubtypes",	},
+    { NULL,			}
+  };
+
+/* Whether section NAME is the debug section SEC_NAME.  Split DWARF
+   (.dwo and .dwp) files have the same sections with a .dwo suffix.  */
+static bool
+debug_section_name_eq (const char *name, const char *sec_name)
+{
+  size_t len = strlen (sec_name);
+  return (strncmp (name, sec_name, len) == 0
+	  && (name[len] == '\0' || strcmp (name + len, ".dwo") == 0));
+}
+
+static void
+setup_lines (struct debug_lines *lines)
+{
+  lines->table = NULL;
+  lines->size = 0;
+  lines->used = 0;
+  lines->debug_lines_len = 0;
+  lines->line_buf = NULL;
+}
+
+static void
+destroy_lines (struct debug_lines *lines)
+{
+  free (lines->table);
+  free (lines->line_buf);
+}
+
+/* Returns SIZE bytes of (suitably aligned) memory from arena A, or
+   NULL if out of memory.  */
+static void *
+arena_alloc (struct arena *a, size_t size)
+{
+  const size_t align = __alignof__ (max_align_t);
+  size = (size + align - 1) & ~(align - 1);
+
+  struct arena_block *b = a->block;
+  if (b == NULL || b->size - b->used < size)
+    {
+      size_t bsize = MAX ((size_t) ARENA_BLOCK_SIZE, size);
+      b = malloc (sizeof (struct arena_block) + bsize);
+      if (b == NULL)
+	return NULL;
+      b->prev = a->block;
+      b->size = bsize;
+      b->used = 0;
+      a->block = b;
+    }
+
+  void *p = (char *) b->memory + b->used;
+  b->used += size;
+  return p;
+}
+
+static char *
+arena_strdup (struct arena *a, const char *str)
+{
+  size_t size = strlen (str) + 1;
+  char *p = arena_alloc (a, size);
+  if (p != NULL)
+    memcpy (p, str, size);
+  return p;
+}
+
+static struct arena_mark
+arena_mark (struct arena *a)
+{
+  struct arena_mark m = { a->block, a->block ? a->block->used : 0 };
+  return m;
+}
+
+/* Release everything allocated from A since mark M was taken.  */
+static void
+arena_release (struct arena *a, struct arena_mark m)
+{
+  while (a->block != m.block)
+    {
+      struct arena_block *prev = a->block->prev;
+      free (a->block);
+      a->block = prev;
+    }
+  if (a->block != NULL)
+    a->block->used = m.used;
+}
+
+static void
+destroy_arena (struct arena *a)
+{
+  arena_release (a, (struct arena_mark) { NULL, 0 });
+}
+
+static void
+destroy_scn_bufs (DSO *dso)
+{
+  if (dso->scn_bufs != NULL)
+    {
+      for (int i = 0; i < dso->ehdr.e_shnum; i++)
+	free (dso->scn_bufs[i]);
+      free (dso->scn_bufs);
+    }
+}
+
+#define read_uleb128(ptr) ({		\
+  unsigned int ret = 0;			\
+  unsigned int c;			\
+  int shift = 0;			\
+  do					\
+    {					\
+      c = *(ptr)++;			\
+      ret |= (c & 0x7f) << shift;	\
+      shift += 7;			\
+    } while (c & 0x80);			\
+					\
+  if (shift >= 35)			\
+    ret = UINT_MAX;			\
+  ret;					\
+})
+
+#define write_uleb128(ptr,val) ({	\
+  uint32_t valv = (val);		\
+  do					\
+    {					\
+      unsigned char c = valv & 0x7f;	\
+      valv >>= 7;			\
+      if (valv)				\
+	c |= 0x80;			\
+      *(ptr)++ = c;			\
+    }					\
+  while (valv);				\
+})
+
+static __thread uint16_t (*do_read_16) (unsigned char *ptr);
+static __thread uint32_t (*do_read_24) (unsigned char *ptr);
+static __thread uint32_t (*do_read_32) (unsigned char *ptr);
+static __thread uint64_t (*do_read_64) (unsigned char *ptr);
+static __thread void (*do_write_16) (unsigned char *ptr, uint16_t val);
+static __thread void (*do_write_32) (unsigned char *ptr, uint32_t val);
+static __thread void (*do_write_64) (unsigned char *ptr, uint64_t val);
+
+static inline uint16_t
+buf_read_ule16 (unsigned char *data)
+{
+  return data[0] | (data[1] << 8);
+}
+
+static inline uint16_t
+buf_read_ube16 (unsigned char *data)
+{
+  return data[1] | (data[0] << 8);
+}
+
+static inline uint32_t
+buf_read_ule24 (unsigned char *data)
+{
+  return data[0] | (data[1] << 8) | (data[2] << 16);
+}
+
+static inline uint32_t
+buf_read_ube24 (unsigned char *data)
+{
+  return data[2] | (data[1] << 8) | (data[0] << 16);
+}
+
+static inline uint32_t
+buf_read_ule32 (unsigned char *data)
+{
+  return data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+}
+
+static inline uint32_t
+buf_read_ube32 (unsigned char *data)
+{
+  return data[3] | (data[2] << 8) | (data[1] << 16) | (data[0] << 24);
+}
+
+static inline uint64_t
+buf_read_ule64 (unsigned char *data)
+{
+  return buf_read_ule32 (data) | ((uint64_t) buf_read_ule32 (data + 4) << 32);
+}
+
+static inline uint64_t
+buf_read_ube64 (unsigned char *data)
+{
+  return buf_read_ube32 (data + 4) | ((uint64_t) buf_read_ube32 (data) << 32);
+}
+
+static const char *
+strptr (DSO *dso, size_t sec, size_t offset)
+{
+  return elf_strptr (dso->elf, sec, offset);
+}
+
+
+#define read_8(ptr) *(ptr)++
+
+#define read_16(ptr) ({					\
+  uint16_t ret = do_read_16 (ptr);			\
+  ptr += 2;						\
+  ret;							\
+})
+
+#define read_32(ptr) ({					\
+  uint32_t ret = do_read_32 (ptr);			\
+  ptr += 4;						\
+  ret;							\
+})
+
+#define read_64(ptr) ({					\
+  uint64_t ret = do_read_64 (ptr);			\
+  ptr += 8;						\
+  ret;							\
+})
+
+/* Size of the initial length field of a unit, 4 for 32-bit DWARF and
+   12 (0xffffffff escape plus 64-bit length) for 64-bit DWARF.  */
+#define INITIAL_LENGTH_SIZE(offset_size) ((offset_size) == 8 ? 12 : 4)
+
+/* Reads the initial length field of a unit.  Sets OFFSET_SIZE to the
+   size of the section offsets in the unit, 4 for 32-bit DWARF and 8
+   for 64-bit DWARF.  */
+#define read_initial_length(ptr, offset_size) ({	\
+  uint64_t len = read_32 (ptr);				\
+  offset_size = 4;					\
+  if (len == 0xffffffff)				\
+    {							\
+      len = read_64 (ptr);				\
+      offset_size = 8;					\
+    }							\
+  len;							\
+})
+
+/* Used for do_write_32_relocated, which can only be called
+   immediately following do_read_32_relocated.  */
+static __thread REL *last_relptr;
+static __thread REL *last_relend;
+static __thread int last_reltype;
+static __thread struct debug_section *last_sec;
+
+/* How far find_rel_for_ptr steps the cursor forward before giving
+   up and doing a binary search on the rest of the section.  */
+#define REL_CURSOR_STEPS 8
+
+/* Returns the first REL in SEC at or after XPTR, or relend.  The
+   DWARF walkers read a section mostly front to back, so the lookup
+   starts at the cursor left by the previous one and only needs a
+   binary search on backward or long forward jumps.  */
+static inline REL *
+find_rel_for_ptr (unsigned char *xptr, struct debug_section *sec)
+{
+  REL *relptr = sec->relbuf;
+  REL *relend = sec->relend;
+  REL *cur = sec->relcur;
+
+  if (cur == NULL)
+    cur = relptr;
+
+  if (cur > relptr && cur[-1].ptr >= xptr)
+    /* Backward jump, the answer is before the cursor.  */
+    relend = cur;
+  else
+    {
+      int steps;
+      for (steps = 0; steps < REL_CURSOR_STEPS; steps++)
+	{
+	  if (cur == relend || cur->ptr >= xptr)
+	    {
+	      sec->relcur = cur;
+	      return cur;
+	    }
+	  cur++;
+	}
+      relptr = cur;
+    }
+
+  size_t l = 0, r = relend - relptr;
+  while (l < r)
+    {
+      size_t m = (l + r) / 2;
+      if (relptr[m].ptr < xptr)
+	l = m + 1;
+      else
+	r = m;
+    }
+  sec->relcur = &relptr[l];
+  return sec->relcur;
+}
+
+#define do_read_32_relocated(xptr, xsec) ({		\
+  uint32_t dret = do_read_32 (xptr);			\
+  REL *relptr = xsec->relbuf;		\
+  REL *relend = xsec->relend;		\
+  int reltype = xsec->reltype;		\
+  if (relptr)						\
+    {							\
+      relptr = find_rel_for_ptr (xptr, xsec);		\
+      if (relptr < relend && relptr->ptr == (xptr))	\
+	{						\
+	  if (reltype == SHT_REL)			\
+	    dret += relptr->addend;			\
+	  else						\
+	    dret = relptr->addend;			\
+	}						\
+    }							\
+  last_relptr = relptr;					\
+  last_relend = relend;					\
+  last_reltype = reltype;				\
+  last_sec = xsec;					\
+  dret;							\
+})
+
+#define read_32_relocated(ptr,sec) ({			\
+  uint32_t ret = do_read_32_relocated (ptr,sec);	\
+  ptr += 4;						\
+  ret;							\
+})
+
+static void
+dwarf2_write_le16 (unsigned char *p, uint16_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void
+dwarf2_write_le32 (unsigned char *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void
+dwarf2_write_be16 (unsigned char *p, uint16_t v)
+{
+  p[1] = v;
+  p[0] = v >> 8;
+}
+
+static void
+dwarf2_write_be32 (unsigned char *p, uint32_t v)
+{
+  p[3] = v;
+  p[2] = v >> 8;
+  p[1] = v >> 16;
+  p[0] = v >> 24;
+}
+
+static void
+dwarf2_write_le64 (unsigned char *p, uint64_t v)
+{
+  dwarf2_write_le32 (p, v);
+  dwarf2_write_le32 (p + 4, v >> 32);
+}
+
+static void
+dwarf2_write_be64 (unsigned char *p, uint64_t v)
+{
+  dwarf2_write_be32 (p, v >> 32);
+  dwarf2_write_be32 (p + 4, v);
+}
+
+#define write_8(ptr,val) ({	\
+  *ptr++ = (val);		\
+})
+
+#define write_16(ptr,val) ({	\
+  do_write_16 (ptr,val);	\
+  ptr += 2;			\
+})
+
+#define write_32(ptr,val) ({	\
+  do_write_32 (ptr,val);	\
+  ptr += 4;			\
+})
+
+#define write_64(ptr,val) ({	\
+  do_write_64 (ptr,val);	\
+  ptr += 8;			\
+})
+
+/* relocated writes can only be called immediately after
+   do_read_32_relocated.  ptr must be equal to relptr->ptr (or
+   relend). Might just update the addend. So relocations need to be
+   updated at the end.  */
+
+#define do_write_32_relocated(ptr,val) ({		\
+  if (last_relptr && last_relptr < last_relend		\
+      && last_relptr->ptr == ptr)			\
+    {							\
+      if (last_reltype == SHT_REL)			\
+	do_write_32 (ptr, val - last_relptr->addend);	\
+      else						\
+	{						\
+	  last_relptr->addend = val;			\
+	  last_sec->rel_updated = true;	\
+	}						\
+    }							\
+  else							\
+    do_write_32 (ptr,val);				\
+})
+
+#define write_32_relocated(ptr,val) ({ \
+  do_write_32_relocated (ptr,val);     \
+  ptr += 4;			       \
+})
+
+/* Section offsets are 4 bytes in 32-bit DWARF and 8 bytes in 64-bit
+   DWARF units.  Only the 4 byte ones can be relocated, setup_relbuf
+   doesn't accept 64-bit relocations.  The 8 byte variants reset
+   last_relptr so a following write doesn't pick up a stale one.  */
+#define do_read_offset_relocated(xptr, xsec, xsize) ({	\
+  uint64_t oret;					\
+  if ((xsize) == 8)					\
+    {							\
+      oret = do_read_64 (xptr);				\
+      last_relptr = NULL;				\
+    }							\
+  else							\
+    oret = do_read_32_relocated (xptr, xsec);		\
+  oret;							\
+})
+
+#define read_offset_relocated(ptr,sec,size) ({		\
+  uint64_t ret = do_read_offset_relocated (ptr,sec,size);	\
+  ptr += (size);					\
+  ret;							\
+})
+
+#define do_write_offset_relocated(ptr,val,size) ({	\
+  if ((size) == 8)					\
+    do_write_64 (ptr,val);				\
+  else							\
+    do_write_32_relocated (ptr,val);			\
+})
+
+#define write_offset_relocated(ptr,val,size) ({	\
+  do_write_offset_relocated (ptr,val,size);	\
+  ptr += (size);				\
+})
+
+/* Returns the data of section I of DSO, which must be one buffer
+   holding the whole section of SIZE bytes.  */
+static Elf_Data *
+section_data (DSO *dso, int i, size_t size)
+{
+  Elf_Data *data = elf_getdata (dso->scn[i], NULL);
+  if (data == NULL || data->d_buf == NULL)
+    error (1, 0, "%s: Couldn't get section data: %s", dso->filename,
+	   elf_errmsg (-1));
+  if (elf_getdata (dso->scn[i], data) != NULL || data->d_off != 0
+      || data->d_size != size)
+    error (1, 0, "%s: Unexpected section data", dso->filename);
+  return data;
+}
+
+/* Returns the bitmap of symbols in symbol table section SYMTAB that
+   are defined in one of the debug sections whose offsets we might
+   rewrite (.debug_str, .debug_str_offsets, .debug_line,
+   .debug_line_str, .debug_macro and .debug_abbrev).  All .rel(a).debug_*
+   sections normally share one symbol table, so this is only computed
+   once per DSO.  */
+static const unsigned char *
+get_rel_syms (DSO *dso, int symtab, Elf_Data *symdata, size_t *nsyms)
+{
+  if (dso->rel_syms != NULL && dso->rel_symtab == symtab)
+    {
+      *nsyms = dso->rel_nsyms;
+      return dso->rel_syms;
+    }
+
+  size_t n = symdata->d_size / gelf_fsize (dso->elf, ELF_T_SYM, 1,
+					   EV_CURRENT);
+  unsigned char *bits = calloc ((n + 7) / 8, 1);
+  if (bits == NULL)
+    error (1, errno, "%s: Could not allocate memory", dso->filename);
+  /* Owned by the DSO right away, so free_dso releases it when getting
+     a symbol below fails.  */
+  free (dso->rel_syms);
+  dso->rel_syms = bits;
+  dso->rel_symtab = -1;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      GElf_Sym sym;
+      if (gelf_getsym (symdata, i, &sym) == NULL)
+	error (1, 0, "%s: Couldn't get symbol: %s", dso->filename,
+	       elf_errmsg (-1));
+      if (sym.st_shndx != 0
+	  && (sym.st_shndx == debug_sections[DEBUG_STR].sec
+	      || sym.st_shndx == debug_sections[DEBUG_STR_OFFSETS].sec
+	      || sym.st_shndx == debug_sections[DEBUG_LINE].sec
+	      || sym.st_shndx == debug_sections[DEBUG_LINE_STR].sec
+	      || sym.st_shndx == debug_sections[DEBUG_MACRO].sec
+	      || sym.st_shndx == debug_sections[DEBUG_ABBREV].sec))
+	bits[i / 8] |= 1 << (i % 8);
+    }
+
+  dso->rel_nsyms = n;
+  dso->rel_symtab = symtab;
+  *nsyms = n;
+  return bits;
+}
+
+/* Like gelf_getrel/gelf_getrela, but indexes the section data
+   directly.  libelf already converted it to host byte order, so only
+   the class matters.  */
+static inline void
+get_rel (bool is64, int type, Elf_Data *data, int ndx,
+	 GElf_Rela *rela)
+{
+  if (is64)
+    {
+      if (type == SHT_REL)
+	{
+	  const Elf64_Rel *rel = (const Elf64_Rel *) data->d_buf + ndx;
+	  rela->r_offset = rel->r_offset;
+	  rela->r_info = rel->r_info;
+	  rela->r_addend = 0;
+	}
+      else
+	*rela = ((const Elf64_Rela *) data->d_buf)[ndx];
+    }
+  else
+    {
+      Elf32_Word info;
+      if (type == SHT_REL)
+	{
+	  const Elf32_Rel *rel = (const Elf32_Rel *) data->d_buf + ndx;
+	  rela->r_offset = rel->r_offset;
+	  info = rel->r_info;
+	  rela->r_addend = 0;
+	}
+      else
+	{
+	  const Elf32_Rela *rel = (const Elf32_Rela *) data->d_buf + ndx;
+	  rela->r_offset = rel->r_offset;
+	  info = rel->r_info;
+	  rela->r_addend = rel->r_addend;
+	}
+      rela->r_info = GELF_R_INFO (ELF32_R_SYM (info), ELF32_R_TYPE (info));
+    }
+}
+
+/* Likewise for the st_value of symbol NDX.  */
+static inline GElf_Addr
+get_sym_value (bool is64, Elf_Data *symdata, size_t ndx)
+{
+  if (is64)
+    return ((const Elf64_Sym *) symdata->d_buf)[ndx].st_value;
+  return ((const Elf32_Sym *) symdata->d_buf)[ndx].st_value;
+}
+
+/* Sets the r_offset of relocation NDX in DATA, see get_rel.  The
+   caller flags DATA dirty once it is done.  */
+static inline void
+set_rel_offset (bool is64, int type, Elf_Data *data, int ndx,
+		GElf_Addr r_offset)
+{
+  if (is64)
+    {
+      if (type == SHT_REL)
+	((Elf64_Rel *) data->d_buf)[ndx].r_offset = r_offset;
+      else
+	((Elf64_Rela *) data->d_buf)[ndx].r_offset = r_offset;
+    }
+  else
+    {
+      if (type == SHT_REL)
+	((Elf32_Rel *) data->d_buf)[ndx].r_offset = r_offset;
+      else
+	((Elf32_Rela *) data->d_buf)[ndx].r_offset = r_offset;
+    }
+}
+
+/* get_rel and set_rel_offset index the data as an array of the
+   native Rel/Rela type, make sure that is what relocation section
+   RELSEC holds.  */
+static void
+check_rel_entsize (DSO *dso, int relsec, const char *name)
+{
+  int type = dso->shdr[relsec].sh_type;
+  if (dso->shdr[relsec].sh_entsize
+      != gelf_fsize (dso->elf, type == SHT_REL ? ELF_T_REL : ELF_T_RELA,
+		     1, EV_CURRENT))
+    error (1, 0, "%s: Unexpected relocation entry size for %s section",
+	   dso->filename, name);
+}
+
+/* Sorts the N relocations in RELBUF on ptr, all of which are at most
+   MAXOFF bytes after BASE, with an LSD radix sort on the offset.  */
+static void
+sort_relbuf (DSO *dso, REL *relbuf, size_t n, unsigned char *base,
+	     size_t maxoff)
+{
+  REL *tmp = malloc (n * sizeof (REL));
+  if (tmp == NULL)
+    error (1, errno, "%s: Could not allocate memory", dso->filename);
+
+  REL *from = relbuf, *to = tmp;
+  for (unsigned int shift = 0;
+       shift < sizeof (size_t) * 8 && (maxoff >> shift) != 0;
+       shift += 8)
+    {
+      size_t count[256] = { 0 };
+      size_t i;
+      for (i = 0; i < n; i++)
+	count[((size_t) (from[i].ptr - base) >> shift) & 0xff]++;
+      /* All keys share this digit, nothing to do.  */
+      if (count[((size_t) (from[0].ptr - base) >> shift) & 0xff] == n)
+	continue;
+      size_t pos = 0;
+      for (i = 0; i < 256; i++)
+	{
+	  size_t c = count[i];
+	  count[i] = pos;
+	  pos += c;
+	}
+      for (i = 0; i < n; i++)
+	to[count[((size_t) (from[i].ptr - base) >> shift) & 0xff]++]
+	  = from[i];
+      REL *t = from;
+      from = to;
+      to = t;
+    }
+
+  if (from != relbuf)
+    memcpy (relbuf, from, n * sizeof (REL));
+  free (tmp);
+}
+
+/* Returns a malloced REL array, or NULL when there are no relocations
+   for this section.  When there are relocations, will setup relend,
+   as the last REL, and reltype, as SHT_REL or SHT_RELA.  */
+static void
+setup_relbuf (DSO *dso, debug_section *sec)
+{
+  int ndx, maxndx;
+  GElf_Rela rela;
+  GElf_Addr base = dso->shdr[sec->sec].sh_addr;
+  Elf_Data *symdata = NULL;
+  int rtype;
+  REL *relbuf;
+  REL *relend;
+  Elf_Data *data;
+  int i = sec->relsec;
+  bool is64 = gelf_getclass (dso->elf) == ELFCLASS64;
+  const unsigned char *rel_syms;
+  size_t nsyms, maxoff = 0;
+  bool sorted = true;
+
+  /* No relocations, or did we do this already? */
+  if (i == 0 || sec->relbuf != NULL)
+    {
+      last_relptr = NULL;
+      last_relend = NULL;
+      last_reltype = 0;
+      last_sec = NULL;
+      return;
+    }
+
+  data = section_data (dso, i, dso->shdr[i].sh_size);
+  sec->reltype = dso->shdr[i].sh_type;
+  check_rel_entsize (dso, i, sec->name);
+  maxndx = dso->shdr[i].sh_size / dso->shdr[i].sh_entsize;
+  relbuf = malloc (maxndx * sizeof (REL));
+  if (relbuf == NULL)
+    error (1, errno, "%s: Could not allocate memory", dso->filename);
+  /* So reset_debug_sections frees it when a relocation is rejected.  */
+  sec->relbuf = relbuf;
+
+  symdata = section_data (dso, dso->shdr[i].sh_link,
+			  dso->shdr[dso->shdr[i].sh_link].sh_size);
+  rel_syms = get_rel_syms (dso, dso->shdr[i].sh_link, symdata, &nsyms);
+
+  for (ndx = 0, relend = relbuf; ndx < maxndx; ++ndx)
+    {
+      get_rel (is64, sec->reltype, data, ndx, &rela);
+      size_t symndx = GELF_R_SYM (rela.r_info);
+      if (symndx >= nsyms)
+	error (1, 0, "%s: Invalid symbol index %zd at [%d] for %s section",
+	       dso->filename, symndx, ndx, sec->name);
+      /* Only consider relocations against .debug_str,
+	 .debug_str_offsets, .debug_line, .debug_line_str,
+	 .debug_macro and .debug_abbrev.  */
+      if ((rel_syms[symndx / 8] & (1 << (symndx % 8))) == 0)
+	continue;
+      GElf_Addr value = get_sym_value (is64, symdata, symndx);
+      /* Relocations against section symbols are uninteresting in REL.  */
+      if (sec->reltype == SHT_REL && value == 0)
+	continue;
+      rela.r_addend += value;
+      rtype = ELF64_R_TYPE (rela.r_info);
+      switch (dso->ehdr.e_machine)
+	{
+	case EM_SPARC:
+	case EM_SPARC32PLUS:
+	case EM_SPARCV9:
+	  if (rtype != R_SPARC_32 && rtype != R_SPARC_UA32)
+	    goto fail;
+	  break;
+	case EM_386:
+	  if (rtype != R_386_32)
+	    goto fail;
+	  break;
+	case EM_PPC:
+	case EM_PPC64:
+	  if (rtype != R_PPC_ADDR32 && rtype != R_PPC_UADDR32)
+	    goto fail;
+	  break;
+	case EM_S390:
+	  if (rtype != R_390_32)
+	    goto fail;
+	  break;
+	case EM_PARISC:
+	  if (rtype != R_PARISC_DIR32)
+	    goto fail;
+	  break;
+	case EM_IA_64:
+	  if (rtype != R_IA64_SECREL32LSB)
+	    goto fail;
+	  break;
+	case EM_X86_64:
+	  if (rtype != R_X86_64_32)
+	    goto fail;
+	  break;
+	case EM_ALPHA:
+	  if (rtype != R_ALPHA_REFLONG)
+	    goto fail;
+	  break;
+#if defined(EM_AARCH64) && defined(R_AARCH64_ABS32)
+	case EM_AARCH64:
+	  if (rtype != R_AARCH64_ABS32)
+	    goto fail;
+	  break;
+#endif
+	case EM_68K:
+	  if (rtype != R_68K_32)
+	    goto fail;
+	  break;
+#if defined(EM_RISCV) && defined(R_RISCV_32)
+	case EM_RISCV:
+	  if (rtype != R_RISCV_32)
+	    goto fail;
+	  break;
+#endif
+#if defined(EM_MCST_ELBRUS) && defined(R_E2K_32_ABS)
+	case EM_MCST_ELBRUS:
+	  if (rtype != R_E2K_32_ABS)
+		  goto fail;
+	  break;
+#endif
+#if defined(EM_LOONGARCH) && defined(R_LARCH_32)
+  case EM_LOONGARCH:
+    if (rtype != R_LARCH_32)
+      goto fail;
+    break;
+#endif
+	default:
+	fail:
+	  error (1, 0, "%s: Unhandled relocation %d at [%d] for %s section",
+		 dso->filename, rtype, ndx, sec->name);
+	}
+      size_t off = rela.r_offset - base;
+      if (off < maxoff)
+	sorted = false;
+      else
+	maxoff = off;
+      relend->ptr = sec->data + off;
+      relend->addend = rela.r_addend;
+      relend->ndx = ndx;
+      ++(relend);
+    }
+  if (relbuf == relend)
+    {
+      free (relbuf);
+      relbuf = NULL;
+      relend = NULL;
+    }
+  else if (! sorted)
+    sort_relbuf (dso, relbuf, relend - relbuf, sec->data, maxoff);
+
+  sec->relbuf = relbuf;
+  sec->relend = relend;
+  sec->relcur = relbuf;
+  last_relptr = NULL;
+}
+
+/* Updates SHT_RELA section associated with the given section based on
+   the relbuf data. The relbuf data is freed at the end.  */
+static void
+update_rela_data (DSO *dso, struct debug_section *sec)
+{
+  if (! sec->rel_updated)
+    {
+      free (sec->relbuf);
+      sec->relbuf = NULL;
+      return;
+    }
+
+  Elf_Data *symdata;
+  int relsec_ndx = sec->relsec;
+  Elf_Data *data = elf_getdata (dso->scn[relsec_ndx], NULL);
+  symdata = elf_getdata (dso->scn[dso->shdr[relsec_ndx].sh_link],
+			 NULL);
+
+  REL *relptr = sec->relbuf;
+  REL *relend = sec->relend;
+  while (relptr < relend)
+    {
+      GElf_Sym sym;
+      GElf_Rela rela;
+      int ndx = relptr->ndx;
+
+      if (gelf_getrela (data, ndx, &rela) == NULL)
+	error (1, 0, "Couldn't get relocation: %s",
+	       elf_errmsg (-1));
+
+      if (gelf_getsym (symdata, GELF_R_SYM (rela.r_info),
+		       &sym) == NULL)
+	error (1, 0, "Couldn't get symbol: %s", elf_errmsg (-1));
+
+      rela.r_addend = relptr->addend - sym.st_value;
+
+      if (gelf_update_rela (data, ndx, &rela) == 0)
+	error (1, 0, "Couldn't update relocations: %s",
+	       elf_errmsg (-1));
+
+      ++relptr;
+    }
+  elf_flagdata (data, ELF_C_SET, ELF_F_DIRTY);
+
+  free (sec->relbuf);
+  sec->relbuf = NULL;
+}
+
+static inline uint32_t
+do_read_uleb128 (unsigned char *ptr)
+{
+  unsigned char *uleb_ptr = ptr;
+  return read_uleb128 (uleb_ptr);
+}
+
+/* Reads the string offset of a string FORM attribute at PTR in SEC,
+   in a unit with OFFSET_SIZE offsets.  Indexed strings are looked up
+   in the .debug_str_offsets contribution of CU.  */
+static inline size_t
+do_read_str_form_relocated (DSO *dso, uint32_t form, unsigned char *ptr,
+			    struct debug_section *sec, int offset_size,
+			    struct CU *cu)
+{
+  uint32_t idx;
+  switch (form)
+    {
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+      return do_read_offset_relocated (ptr, sec, offset_size);
+
+    case DW_FORM_strx1:
+      idx = *ptr;
+      break;
+    case DW_FORM_strx2:
+      idx = do_read_16 (ptr);
+      break;
+    case DW_FORM_strx3:
+      idx = do_read_24 (ptr);
+      break;
+    case DW_FORM_strx4:
+      idx = do_read_32 (ptr);
+      break;
+    case DW_FORM_strx:
+      idx = do_read_uleb128 (ptr);
+      break;
+    default:
+      error (1, 0, "Unhandled string form DW_FORM_0x%x", form);
+      return -1;
+    }
+
+  unsigned char *str_off_ptr = debug_sections[DEBUG_STR_OFFSETS].data;
+  str_off_ptr += cu->str_offsets_base;
+  str_off_ptr += (size_t) idx * cu->offset_size;
+
+  struct debug_section *str_offsets_sec = &debug_sections[DEBUG_STR_OFFSETS];
+  setup_relbuf(dso, str_offsets_sec);
+
+  return do_read_offset_relocated (str_off_ptr, str_offsets_sec,
+				   cu->offset_size);
+}
+
+struct abbrev_attr
+  {
+    unsigned int attr;
+    unsigned int form;
+  };
+
+struct abbrev_tag
+  {
+    unsigned int entry;
+    unsigned int tag;
+    int nattr;
+    struct abbrev_attr attr[0];
+  };
+
+static hashval_t
+abbrev_hash (const void *p)
+{
+  struct abbrev_tag *t = (struct abbrev_tag *)p;
+
+  return t->entry;
+}
+
+static int
+abbrev_eq (const void *p, const void *q)
+{
+  struct abbrev_tag *t1 = (struct abbrev_tag *)p;
+  struct abbrev_tag *t2 = (struct abbrev_tag *)q;
+
+  return t1->entry == t2->entry;
+}
+
+/* Read the abbrevs at PTR into a new hash table.  The abbrev_tags
+   themselves are allocated from the DSO arena.  */
+static htab_t
+read_abbrev (DSO *dso, unsigned char *ptr)
+{
+  htab_t h = htab_try_create (50, abbrev_hash, abbrev_eq, NULL);
+  unsigned int attr, form;
+  struct abbrev_tag *t;
+  int nattr;
+  void **slot;
+
+  if (h == NULL)
+    {
+no_memory:
+      error (0, ENOMEM, "%s: Could not read .debug_abbrev", dso->filename);
+      if (h)
+        htab_delete (h);
+      return NULL;
+    }
+
+  while ((attr = read_uleb128 (ptr)) != 0)
+    {
+      /* Count the attributes first, so the tag can be allocated at
+	 once.  */
+      unsigned char *aptr = ptr;
+      read_uleb128 (aptr); /* tag */
+      ++aptr; /* children flag.  */
+      nattr = 0;
+      while (read_uleb128 (aptr) != 0)
+	{
+	  if (read_uleb128 (aptr) == DW_FORM_implicit_const)
+	    read_uleb128 (aptr);
+	  nattr++;
+	}
+
+      t = arena_alloc (&dso->arena,
+		       sizeof (*t) + nattr * sizeof (struct abbrev_attr));
+      if (t == NULL)
+        goto no_memory;
+      t->entry = attr;
+      t->nattr = 0;
+      slot = htab_find_slot (h, t, INSERT);
+      if (slot == NULL)
+	goto no_memory;
+      if (*slot != NULL)
+	{
+	  error (0, 0, "%s: Duplicate DWARF abbreviation %d", dso->filename,
+		 t->entry);
+	  htab_delete (h);
+	  return NULL;
+	}
+      t->tag = read_uleb128 (ptr);
+      ++ptr; /* skip children flag.  */
+      while ((attr = read_uleb128 (ptr)) != 0)
+        {
+	  form = read_uleb128 (ptr);
+	  if (form == 2
+	      || (form > DW_FORM_flag_present
+		  && !(form == DW_FORM_ref_sig8
+		       || form == DW_FORM_data16
+		       || form == DW_FORM_line_strp
+		       || form == DW_FORM_implicit_const
+		       || form == DW_FORM_addrx
+		       || form == DW_FORM_loclistx
+		       || form == DW_FORM_rnglistx
+		       || form == DW_FORM_addrx1
+		       || form == DW_FORM_addrx2
+		       || form == DW_FORM_addrx3
+		       || form == DW_FORM_addrx4
+		       || form == DW_FORM_strx
+		       || form == DW_FORM_strx1
+		       || form == DW_FORM_strx2
+		       || form == DW_FORM_strx3
+		       || form == DW_FORM_strx4)))
+	    {
+	      error (0, 0, "%s: Unknown DWARF DW_FORM_0x%x", dso->filename,
+		     form);
+	      htab_delete (h);
+	      return NULL;
+	    }
+	  if (form == DW_FORM_implicit_const)
+	    {
+	      /* It is SLEB128 but the value is dropped anyway.  */
+	      read_uleb128 (ptr);
+	    }
+
+	  t->attr[t->nattr].attr = attr;
+	  t->attr[t->nattr++].form = form;
+        }
+      if (read_uleb128 (ptr) != 0)
+        {
+	  error (0, 0, "%s: DWARF abbreviation does not end with 2 zeros",
+		 dso->filename);
+	  htab_delete (h);
+	  return NULL;
+        }
+      *slot = t;
+    }
+
+  return h;
+}
+
+#define IS_DIR_SEPARATOR(c) ((c)=='/')
+
+static char *
+canonicalize_path (const char *s, char *d)
+{
+  char *rv = d;
+  char *droot;
+
+  if (IS_DIR_SEPARATOR (*s))
+    {
+      *d++ = *s++;
+      if (IS_DIR_SEPARATOR (*s) && !IS_DIR_SEPARATOR (s[1]))
+	{
+	  /* Special case for "//foo" meaning a Posix namespace
+	     escape.  */
+	  *d++ = *s++;
+	}
+      while (IS_DIR_SEPARATOR (*s))
+	s++;
+    }
+  droot = d;
+
+  while (*s)
+    {
+      /* At this point, we're always at the beginning of a path
+	 segment.  */
+
+      if (s[0] == '.' && (s[1] == 0 || IS_DIR_SEPARATOR (s[1])))
+	{
+	  s++;
+	  if (*s)
+	    while (IS_DIR_SEPARATOR (*s))
+	      ++s;
+	}
+
+      else if (s[0] == '.' && s[1] == '.'
+	       && (s[2] == 0 || IS_DIR_SEPARATOR (s[2])))
+	{
+	  char *pre = d - 1; /* includes slash */
+	  while (droot < pre && IS_DIR_SEPARATOR (*pre))
+	    pre--;
+	  if (droot <= pre && ! IS_DIR_SEPARATOR (*pre))
+	    {
+	      while (droot < pre && ! IS_DIR_SEPARATOR (*pre))
+		pre--;
+	      /* pre now points to the slash */
+	      if (droot < pre)
+		pre++;
+	      if (pre + 3 == d && pre[0] == '.' && pre[1] == '.')
+		{
+		  *d++ = *s++;
+		  *d++ = *s++;
+		}
+	      else
+		{
+		  d = pre;
+		  s += 2;
+		  if (*s)
+		    while (IS_DIR_SEPARATOR (*s))
+		      s++;
+		}
+	    }
+	  else
+	    {
+	      *d++ = *s++;
+	      *d++ = *s++;
+	    }
+	}
+      else
+	{
+	  while (*s && ! IS_DIR_SEPARATOR (*s))
+	    *d++ = *s++;
+	}
+
+      if (IS_DIR_SEPARATOR (*s))
+	{
+	  *d++ = *s++;
+	  while (IS_DIR_SEPARATOR (*s))
+	    s++;
+	}
+    }
+  while (droot < d && IS_DIR_SEPARATOR (d[-1]))
+    --d;
+  if (d == rv)
+    *d++ = '.';
+  *d = 0;
+
+  return rv;
+}
+
+/* Returns the rest of PATH if it starts with DIR_PREFIX, skipping any
+   / path separators, or NULL if PATH doesn't start with
+   DIR_PREFIX. Might return the empty string if PATH equals DIR_PREFIX
+   (modulo trailing slashes). Never returns path starting with '/'.
+   Note that DIR_PREFIX itself should NOT end with a '/'.  */
+static const char *
+skip_dir_prefix (const char *path, const char *dir_prefix)
+{
+  size_t prefix_len = strlen (dir_prefix);
+  if (strncmp (path, dir_prefix, prefix_len) == 0)
+    {
+      path += prefix_len;
+      /* Unless path == dir_prefix there should be at least one '/'
+	 in the path (which we will skip).  Otherwise the path has
+	 a different (longer) directory prefix.  */
+      if (*path != '\0' && !IS_DIR_SEPARATOR (*path))
+	return NULL;
+      while (IS_DIR_SEPARATOR (path[0]))
+	path++;
+      return path;
+    }
+
+  return NULL;
+}
+
+/* Returns the length of the path component at the start of PATH.  */
+static size_t
+path_component_len (const char *path)
+{
+  const char *p = path;
+  while (*p != '\0' && ! IS_DIR_SEPARATOR (*p))
+    p++;
+  return p - path;
+}
+
+/* Adds MAP to the trie at ROOT.  A later map for the same old path
+   replaces an earlier one.  Returns false when out of memory.  */
+static bool
+add_prefix_map (struct prefix_node *root, const struct prefix_map *map)
+{
+  struct prefix_node *node = root;
+  const char *p = map->old;
+  while (true)
+    {
+      size_t len = path_component_len (p);
+      struct prefix_node *child;
+      for (child = node->children; child != NULL; child = child->next)
+	if (child->len == len && memcmp (child->name, p, len) == 0)
+	  break;
+      if (child == NULL)
+	{
+	  child = calloc (1, sizeof (struct prefix_node));
+	  if (child == NULL)
+	    return false;
+	  child->name = p;
+	  child->len = len;
+	  child->next = node->children;
+	  node->children = child;
+	}
+      node = child;
+      p += len;
+      if (*p == '\0')
+	break;
+      p++;
+    }
+  node->map = map;
+  return true;
+}
+
+static void
+free_prefix_trie (struct prefix_node *node)
+{
+  while (node != NULL)
+    {
+      struct prefix_node *next = node->next;
+      free_prefix_trie (node->children);
+      free (node);
+      node = next;
+    }
+}
+
+/* Returns the prefix map with the longest old path PATH starts with,
+   or NULL if there is none, and sets *REST to the rest of PATH like
+   skip_dir_prefix does.  All prefix maps are tried at once by walking
+   the trie one path component at a time.  */
+static const struct prefix_map *
+find_prefix_map (const char *path, const char **rest)
+{
+  const struct prefix_map *found = NULL;
+  const struct prefix_node *node = prefix_maps;
+  const char *p = path;
+  while (node != NULL)
+    {
+      size_t len = path_component_len (p);
+      const struct prefix_node *child;
+      for (child = node->children; child != NULL; child = child->next)
+	if (child->len == len && memcmp (child->name, p, len) == 0)
+	  break;
+      if (child == NULL)
+	break;
+      p += len;
+      if (child->map != NULL)
+	{
+	  found = child->map;
+	  *rest = p;
+	}
+      if (*p == '\0')
+	break;
+      p++;
+      node = child;
+    }
+
+  if (found != NULL)
+    while (IS_DIR_SEPARATOR (**rest))
+      (*rest)++;
+  return found;
+}
+
+/* The same directory and file names appear in the line table headers
+   of most CUs.  Remember per DSO whether each unique string starts
+   with the old path of a prefix map and how long it becomes with the
+   new path instead.  */
+struct dir_prefix
+{
+  hashval_t hash;
+  /* strlen (str).  */
+  size_t len;
+  /* Offset in str of the rest of the path after the old path of map
+     (as returned by find_prefix_map), or -1 if there is no map.  */
+  ssize_t rest;
+  /* Size (including zero terminator) with the new path of map
+     replacing the old path.  */
+  size_t new_size;
+  const struct prefix_map *map;
+  const char *str;
+};
+
+static hashval_t
+dir_prefix_hash (const void *p)
+{
+  return ((const struct dir_prefix *) p)->hash;
+}
+
+static int
+dir_prefix_eq (const void *p, const void *q)
+{
+  const struct dir_prefix *d1 = (const struct dir_prefix *) p;
+  const struct dir_prefix *d2 = (const struct dir_prefix *) q;
+  return (d1->hash == d2->hash && d1->len == d2->len
+	  && memcmp (d1->str, d2->str, d1->len) == 0);
+}
+
+/* Returns the (cached) prefix map match of STR, see struct
+   dir_prefix.  */
+static const struct dir_prefix *
+lookup_dir_prefix (DSO *dso, const char *str)
+{
+  size_t len = strlen (str);
+  struct dir_prefix *dp;
+
+  if (dso->dir_prefixes == NULL)
+    {
+      dso->dir_prefixes = htab_try_create (256, dir_prefix_hash,
+					   dir_prefix_eq, free);
+      if (dso->dir_prefixes == NULL)
+	goto no_memory;
+    }
+
+  struct dir_prefix key = { .hash = iterative_hash (str, len, 0),
+			    .len = len, .str = str };
+  void **slot = htab_find_slot_with_hash (dso->dir_prefixes, &key,
+					  key.hash, INSERT);
+  if (slot == NULL)
+    goto no_memory;
+  if (*slot != NULL)
+    return *slot;
+
+  /* Keep our own copy, STR might be in section data that is replaced
+     later.  */
+  dp = malloc (sizeof (struct dir_prefix) + len + 1);
+  if (dp == NULL)
+    goto no_memory;
+  *dp = key;
+  dp->str = memcpy (dp + 1, str, len + 1);
+  *slot = dp;
+
+  const char *rest;
+  dp->map = find_prefix_map (dp->str, &rest);
+  if (dp->map == NULL)
+    {
+      dp->rest = -1;
+      dp->new_size = len + 1;
+    }
+  else
+    {
+      size_t rest_len = len - (rest - dp->str);
+      dp->rest = rest - dp->str;
+      dp->new_size = dp->map->new_len + 1;
+      if (rest_len > 0)
+	dp->new_size += 1 + rest_len;
+    }
+  return dp;
+
+no_memory:
+  error (1, ENOMEM, "%s: Couldn't allocate directory prefix",
+	 dso->filename);
+  return NULL;
+}
+
+/* Write the string of DP, which starts with the old path of its
+   prefix map, with the new path instead to PTR.  Returns the end of
+   the written string (after the zero terminator).  */
+static unsigned char *
+write_dest_dir_path (unsigned char *ptr, const struct dir_prefix *dp)
+{
+  size_t rest_len = dp->len - dp->rest;
+  memcpy (ptr, dp->map->new, dp->map->new_len);
+  ptr += dp->map->new_len;
+  if (rest_len > 0)
+    {
+      *ptr++ = '/';
+      memcpy (ptr, dp->str + dp->rest, rest_len);
+      ptr += rest_len;
+    }
+  *ptr++ = '\0';
+  return ptr;
+}
+
+/* Source file names for the list file are buffered and each unique
+   name is only written once, the same header file is normally used by
+   lots of CUs.  Entries are only flushed as a whole, so concurrent
+   debugedit processes appending to the same list file don't mix up
+   names.  */
+#define LIST_FILE_BUF_SIZE (64 * 1024)
+static __thread char *list_file_buf;
+static __thread size_t list_file_buf_len;
+static __thread htab_t list_file_names;
+
+/* What list_file_add looks up in list_file_names, which holds the
+   entries as plain strings: NAME of LEN bytes, followed by a '/' if
+   SLASH is true.  */
+struct list_file_key
+{
+  const char *name;
+  size_t len;
+  bool slash;
+};
+
+static int
+list_file_name_eq (const void *p, const void *q)
+{
+  const char *entry = (const char *) p;
+  const struct list_file_key *key = (const struct list_file_key *) q;
+  if (strncmp (entry, key->name, key->len) != 0)
+    return 0;
+  entry += key->len;
+  if (key->slash && *entry++ != '/')
+    return 0;
+  return *entry == '\0';
+}
+
+static void
+list_file_write (const char *p, size_t size)
+{
+  while (size > 0)
+    {
+      ssize_t ret = write (list_file_fd, p, size);
+      if (ret == -1)
+	error (1, errno, "Could not write to '%s'", list_file);
+      size -= ret;
+      p += ret;
+    }
+}
+
+/* With --list-index the list file entries are also deduplicated
+   between debugedit processes, like the parallel find-debuginfo jobs
+   that each write their own list file.  The index file holds an open
+   addressing hash set of 128-bit hashes of all entries written by any
+   of them.  It is shared through mmap and protected by flock.  An
+   entry is only written to a list file by whoever adds it to the
+   index first, and only added after it has been written.  */
+#define LIST_INDEX_MAGIC "DEBUGIDX"
+#define LIST_INDEX_VERSION 1
+#define LIST_INDEX_MIN_SLOTS (64 * 1024)
+
+struct list_index_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  /* Number of XXH128_hash_t slots following the header, a power of
+     two.  Empty slots are all zero.  */
+  uint64_t nslots;
+  uint64_t count;
+};
+
+static __thread int list_index_fd = -1;
+static __thread struct list_index_header *list_index_map;
+static __thread size_t list_index_map_size;
+
+/* (Re)map the list index file of SIZE bytes.  */
+static void
+list_index_remap (size_t size)
+{
+  if (list_index_map != NULL)
+    munmap (list_index_map, list_index_map_size);
+  list_index_map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 list_index_fd, 0);
+  if (list_index_map == MAP_FAILED)
+    {
+      list_index_map = NULL;
+      error (1, errno, "Couldn't map list index '%s'", list_index);
+    }
+  list_index_map_size = size;
+}
+
+/* Initialize the header of an index of NSLOTS (empty) slots at INDEX.  */
+static void
+list_index_init (struct list_index_header *index, uint64_t nslots)
+{
+  memcpy (index->magic, LIST_INDEX_MAGIC, sizeof index->magic);
+  index->version = LIST_INDEX_VERSION;
+  index->nslots = nslots;
+  index->count = 0;
+}
+
+/* Lock the list index, creating it when still empty, and make sure
+   we have the current version of it mapped.  */
+static void
+list_index_lock (void)
+{
+  struct stat st;
+  for (;;)
+    {
+      if (flock (list_index_fd, LOCK_EX) != 0)
+	error (1, errno, "Couldn't lock list index '%s'", list_index);
+
+      /* list_index_grow replaces the index by a new file, reopen it if
+	 that happened since we opened it.  */
+      struct stat path_st;
+      if (fstat (list_index_fd, &st) != 0)
+	error (1, errno, "Couldn't stat list index '%s'", list_index);
+      if (stat (list_index, &path_st) == 0
+	  && path_st.st_dev == st.st_dev && path_st.st_ino == st.st_ino)
+	break;
+
+      int fd = open (list_index, O_RDWR|O_CREAT, 0644);
+      if (fd < 0)
+	error (1, errno, "Failed to open list index '%s'", list_index);
+      if (list_index_map != NULL)
+	munmap (list_index_map, list_index_map_size);
+      list_index_map = NULL;
+      close (list_index_fd);
+      list_index_fd = fd;
+    }
+
+  if (st.st_size == 0)
+    {
+      size_t size = (sizeof (struct list_index_header)
+		     + LIST_INDEX_MIN_SLOTS * sizeof (XXH128_hash_t));
+      if (ftruncate (list_index_fd, size) != 0)
+	error (1, errno, "Couldn't create list index '%s'", list_index);
+      list_index_remap (size);
+      list_index_init (list_index_map, LIST_INDEX_MIN_SLOTS);
+    }
+  else if (list_index_map == NULL
+	   || (size_t) st.st_size != list_index_map_size)
+    list_index_remap (st.st_size);
+
+  if (list_index_map_size < sizeof (struct list_index_header)
+      || memcmp (list_index_map->magic, LIST_INDEX_MAGIC,
+		 sizeof list_index_map->magic) != 0
+      || list_index_map->version != LIST_INDEX_VERSION
+      || (list_index_map_size - sizeof (struct list_index_header)
+	  != list_index_map->nslots * sizeof (XXH128_hash_t)))
+    error (1, 0, "'%s' is not a debugedit list index", list_index);
+}
+
+static void
+list_index_unlock (void)
+{
+  if (flock (list_index_fd, LOCK_UN) != 0)
+    error (1, errno, "Couldn't unlock list index '%s'", list_index);
+}
+
+/* Don't keep others waiting for the list index when unwinding from an
+   error while holding its lock.  The index might have been reopened by
+   then, so unlock whatever list_index_fd is.  */
+static void
+cleanup_list_index_lock (void *ptr __attribute__ ((unused)),
+			 size_t size __attribute__ ((unused)))
+{
+  if (list_index_fd != -1)
+    flock (list_index_fd, LOCK_UN);
+}
+
+/* The hash of list file entry ENTRY of SIZE bytes in the list index,
+   never all zero.  */
+static XXH128_hash_t
+list_index_hash (const char *entry, size_t size)
+{
+  XXH128_hash_t hash = XXH3_128bits (entry, size);
+  if (hash.low64 == 0 && hash.high64 == 0)
+    hash.low64 = 1;
+  return hash;
+}
+
+/* Returns the slot for HASH in the (locked) list index INDEX, either
+   the one holding it or the empty one it should go in.  */
+static XXH128_hash_t *
+list_index_slot (struct list_index_header *index, XXH128_hash_t hash)
+{
+  XXH128_hash_t *slots = (XXH128_hash_t *) (index + 1);
+  uint64_t mask = index->nslots - 1;
+  for (uint64_t i = hash.low64 & mask; ; i = (i + 1) & mask)
+    if ((slots[i].low64 == 0 && slots[i].high64 == 0)
+	|| XXH128_isEqual (slots[i], hash))
+      return &slots[i];
+}
+
+/* Add HASH to the (locked) list index INDEX, if not already there.  */
+static void
+list_index_insert (struct list_index_header *index, XXH128_hash_t hash)
+{
+  XXH128_hash_t *slot = list_index_slot (index, hash);
+  if (slot->low64 == 0 && slot->high64 == 0)
+    {
+      *slot = hash;
+      index->count++;
+    }
+}
+
+/* Double the number of slots in the (locked) list index.  The bigger
+   index is made in a new file that is renamed over the old one, so the
+   index is never left half grown.  The new file is locked before it
+   is renamed, others notice the new file in list_index_lock.  */
+static void
+list_index_grow (void)
+{
+  uint64_t nslots = list_index_map->nslots;
+  size_t size = (sizeof (struct list_index_header)
+		 + 2 * nslots * sizeof (XXH128_hash_t));
+  struct stat st;
+  if (fstat (list_index_fd, &st) != 0)
+    error (1, errno, "Couldn't stat list index '%s'", list_index);
+
+  char *tmpname;
+  if (asprintf (&tmpname, "%s.XXXXXX", list_index) < 0)
+    error (1, ENOMEM, "Couldn't grow list index '%s'", list_index);
+  int fd = mkstemp (tmpname);
+  if (fd < 0)
+    {
+      int err = errno;
+      free (tmpname);
+      error (1, err, "Couldn't grow list index '%s'", list_index);
+    }
+
+  struct list_index_header *index = MAP_FAILED;
+  if (fchmod (fd, st.st_mode & 0777) != 0
+      || flock (fd, LOCK_EX) != 0
+      || ftruncate (fd, size) != 0
+      || (index = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0)) == MAP_FAILED)
+    goto fail;
+
+  list_index_init (index, 2 * nslots);
+  XXH128_hash_t *old = (XXH128_hash_t *) (list_index_map + 1);
+  for (uint64_t i = 0; i < nslots; i++)
+    if (old[i].low64 != 0 || old[i].high64 != 0)
+      list_index_insert (index, old[i]);
+
+  if (rename (tmpname, list_index) != 0)
+    goto fail;
+  free (tmpname);
+
+  /* Closing the old index also unlocks it.  */
+  munmap (list_index_map, list_index_map_size);
+  close (list_index_fd);
+  list_index_fd = fd;
+  list_index_map = index;
+  list_index_map_size = size;
+  return;
+
+ fail:;
+  int err = errno;
+  if (index != MAP_FAILED)
+    munmap (index, size);
+  close (fd);
+  unlink (tmpname);
+  free (tmpname);
+  error (1, err, "Couldn't grow list index '%s'", list_index);
+}
+
+/* Write the zero terminated entries in BUF (LEN bytes) to the list
+   file, leaving out those that are already in the list index.  The
+   written entries are only added to the index once they are in the
+   list file, so no entry gets lost when writing fails.  */
+static void
+list_file_write_entries (char *buf, size_t len)
+{
+  if (list_index_fd == -1)
+    {
+      list_file_write (buf, len);
+      return;
+    }
+
+  size_t mark = cleanups_mark ();
+  push_cleanup (cleanup_list_index_lock, NULL, 0);
+  list_index_lock ();
+  size_t keep = 0;
+  for (size_t off = 0; off < len; )
+    {
+      size_t size = strlen (buf + off) + 1;
+      XXH128_hash_t *slot = list_index_slot (list_index_map,
+					     list_index_hash (buf + off,
+							      size));
+      if (slot->low64 == 0 && slot->high64 == 0)
+	{
+	  memmove (buf + keep, buf + off, size);
+	  keep += size;
+	}
+      off += size;
+    }
+  /* Still holding the lock, so nobody else can write (or skip) these
+     entries before we did.  */
+  list_file_write (buf, keep);
+  for (size_t off = 0; off < keep; )
+    {
+      size_t size = strlen (buf + off) + 1;
+      if ((list_index_map->count + 1) * 2 > list_index_map->nslots)
+	list_index_grow ();
+      list_index_insert (list_index_map, list_index_hash (buf + off, size));
+      off += size;
+    }
+  drop_cleanups (mark);
+  list_index_unlock ();
+}
+
+static void capture_list_entry (const char *name, size_t len, bool slash);
+
+static void
+list_file_flush (void)
+{
+  if (list_file_buf_len > 0)
+    list_file_write_entries (list_file_buf, list_file_buf_len);
+  list_file_buf_len = 0;
+}
+
+/* Add NAME (including its zero terminator) to the list file, unless
+   it was already added before.  If DIR is true a trailing '/' is
+   added to distinguish it from regular files.  */
+static void
+list_file_add (const char *name, bool dir)
+{
+  size_t len = strlen (name);
+  bool add_slash = dir && (len == 0 || name[len - 1] != '/');
+  size_t size = len + add_slash + 1;
+
+  if (list_file_names == NULL)
+    {
+      list_file_names = htab_try_create (1024, htab_hash_string,
+					 list_file_name_eq, free);
+      list_file_buf = malloc (LIST_FILE_BUF_SIZE);
+      if (list_file_names == NULL || list_file_buf == NULL)
+	error (1, ENOMEM, "Could not write to '%s'", list_file);
+    }
+
+  if (cur_ctx->capturing)
+    capture_list_entry (name, len, add_slash);
+
+  /* Most names were seen before, only copy new ones.  The hash is the
+     htab_hash_string of the entry.  */
+  struct list_file_key key = { name, len, add_slash };
+  hashval_t hash = htab_hash_string (name);
+  if (add_slash)
+    hash = hash * 67 + '/' - 113;
+  void **slot = htab_find_slot_with_hash (list_file_names, &key, hash,
+					  INSERT);
+  if (slot == NULL)
+    error (1, ENOMEM, "Could not write to '%s'", list_file);
+  if (*slot != NULL)
+    return;
+
+  char *entry = malloc (size);
+  if (entry == NULL)
+    error (1, ENOMEM, "Could not write to '%s'", list_file);
+  memcpy (entry, name, len);
+  if (add_slash)
+    entry[len] = '/';
+  entry[size - 1] = '\0';
+  *slot = entry;
+
+  if (size > LIST_FILE_BUF_SIZE - list_file_buf_len)
+    list_file_flush ();
+  if (size > LIST_FILE_BUF_SIZE)
+    list_file_write_entries (entry, size);
+  else
+    {
+      memcpy (list_file_buf + list_file_buf_len, entry, size);
+      list_file_buf_len += size;
+    }
+}
+
+/* Most strings will be in the existing debug string table. But to
+   replace the base/dest directory prefix we need some new storage.
+   Keep new strings somewhat close together for faster comparison and
+   copying.  SIZE should be at least one (and includes space for the
+   zero terminator). The returned pointer points to uninitialized
+   data.  */
+static char *
+new_string_storage (struct strings *strings, size_t size)
+{
+  assert (size > 0);
+
+  /* If the string is extra long just create a whole block for
+     it. Normally strings are much smaller than STRMEMSIZE. */
+  if (strings->last_block == NULL
+      || size > STRMEMSIZE
+      || strings->stridx > STRMEMSIZE
+      || (STRMEMSIZE - strings->stridx) < size)
+    {
+      struct strmemblock *newblock = malloc (sizeof (struct strmemblock)
+					     + MAX (STRMEMSIZE, size));
+      if (newblock == NULL)
+	return NULL;
+
+      newblock->next = NULL;
+
+      if (strings->blocks == NULL)
+	strings->blocks = newblock;
+
+      if (strings->last_block != NULL)
+	strings->last_block->next = newblock;
+
+      strings->last_block = newblock;
+      strings->stridx = 0;
+    }
+
+  size_t stridx = strings->stridx;
+  strings->stridx += size + 1;
+  return &strings->last_block->memory[stridx];
+}
+
+/* Comparison function used for tsearch. */
+static int
+strent_compare (const void *a, const void *b)
+{
+  struct stridxentry *entry_a = (struct stridxentry *)a;
+  struct stridxentry *entry_b = (struct stridxentry *)b;
+  size_t idx_a = entry_a->idx;
+  size_t idx_b = entry_b->idx;
+
+  if (idx_a < idx_b)
+    return -1;
+
+  if (idx_a > idx_b)
+    return 1;
+
+  return 0;
+}
+
+/* Allocates and inserts a new entry for the old index if not yet
+   seen.  Returns a stridxentry if the given index has not yet been
+   seen and needs to be filled in with the associated string (either
+   the original string or the replacement string). Returns NULL if the
+   idx is already known. Use in phase 0 to add all strings seen. In
+   phase 1 use string_new_offset instead to get the new offsets. */
+static struct stridxentry *
+string_find_new_entry (struct strings *strings, size_t old_idx)
+{
+  /* Use next entry in the pool for lookup so we can use it directly
+     if this is a new index. */
+  struct stridxentry *entry;
+
+  /* Keep entries close together to make key comparison fast. */
+  if (strings->last_entries == NULL || strings->entryidx >= STRIDXENTRIES)
+    {
+      size_t entriessz = (sizeof (struct strentblock)
+			  + (STRIDXENTRIES * sizeof (struct stridxentry)));
+      struct strentblock *newentries = malloc (entriessz);
+      if (newentries == NULL)
+	error (1, errno, "Couldn't allocate new string entries block");
+      else
+	{
+	  if (strings->entries == NULL)
+	    strings->entries = newentries;
+
+	  if (strings->last_entries != NULL)
+	    strings->last_entries->next = newentries;
+
+	  strings->last_entries = newentries;
+	  strings->last_entries->next = NULL;
+	  strings->entryidx = 0;
+	}
+    }
+
+  entry = &strings->last_entries->entry[strings->entryidx];
+  entry->idx = old_idx;
+  struct stridxentry **tres = tsearch (entry, &strings->strent_root,
+				       strent_compare);
+  if (tres == NULL)
+    error (1, ENOMEM, "Couldn't insert new strtab idx");
+  else if (*tres == entry)
+    {
+      /* idx not yet seen, must add actual str.  */
+      strings->entryidx++;
+      return entry;
+    }
+
+  return NULL; /* We already know about this idx, entry already complete. */
+}
+
+/* Returns the offset in the new string table of the string at
+   OLD_IDX in the original one.  Only valid once the new string table
+   has been finalized and the string offsets map has been created by
+   compact_strings.  */
+static size_t
+string_new_offset (struct strings *strings, size_t old_idx)
+{
+  const struct stroff *offs = strings->offs;
+  size_t lo = 0, hi = strings->noffs;
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (offs[mid].old_idx < old_idx)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  /* Can only happen for a bad/non-existing old_idx.  */
+  assert (lo < strings->noffs && offs[lo].old_idx == old_idx);
+  return offs[lo].new_idx;
+}
+
+/* Adds a string_idx_entry given an index into the old/existing string
+   table. Should be used in phase 0. Does nothing if the index was
+   already registered. Otherwise it checks the string associated with
+   the index. If the old string doesn't start with the old path of a
+   prefix map an entry will be recorded for the index with the same
+   string. Otherwise a string will be recorded where that prefix will
+   be replaced by the new path. Returns true if this is a not yet seen index and there
+   a replacement file string has been recorded for it, otherwise
+   returns false.  */
+static bool
+record_file_string_entry_idx (bool line_strp, DSO *dso, size_t old_idx)
+{
+  struct strings *strings = line_strp ? &dso->debug_line_str : &dso->debug_str;
+  bool ret = false;
+  struct stridxentry *entry = string_find_new_entry (strings, old_idx);
+  if (entry != NULL)
+    {
+      debug_section *sec = &debug_sections[line_strp
+					   ? DEBUG_LINE_STR : DEBUG_STR];
+      if (old_idx >= sec->size)
+	error (1, 0, "Bad string pointer index %zd (%s)", old_idx, sec->name);
+
+      Strent *strent;
+      const char *old_str = (char *)sec->data + old_idx;
+      const char *file;
+      const struct prefix_map *map = find_prefix_map (old_str, &file);
+      if (map == NULL)
+	{
+	  /* Just record the existing string.  */
+	  strent = strtab_add_len (strings->str_tab, old_str,
+				   strlen (old_str) + 1);
+	}
+      else
+	{
+	  /* Create and record the altered file path. */
+	  size_t dest_len = map->new_len;
+	  size_t file_len = strlen (file);
+	  size_t nsize = dest_len + 1; /* + '\0' */
+	  if (file_len > 0)
+	    nsize += 1 + file_len;     /* + '/' */
+	  char *nname = new_string_storage (strings, nsize);
+	  if (nname == NULL)
+	    error (1, ENOMEM, "Couldn't allocate new string storage");
+	  memcpy (nname, map->new, dest_len);
+	  if (file_len > 0)
+	    {
+	      nname[dest_len] = '/';
+	      memcpy (nname + dest_len + 1, file, file_len + 1);
+	    }
+	  else
+	    nname[dest_len] = '\0';
+
+	  strent = strtab_add_len (strings->str_tab, nname, nsize);
+	  ret = true;
+	}
+      if (strent == NULL)
+	error (1, ENOMEM, "Could not create new string table entry");
+      else
+	entry->entry = strent;
+    }
+
+  return ret;
+}
+
+/* Same as record_new_string_file_string_entry_idx but doesn't replace
+   any prefix, just records the existing string associated with the
+   index. */
+static void
+record_existing_string_entry_idx (bool line_strp, DSO *dso, size_t old_idx)
+{
+  /* Strings only get rewritten when there are prefix maps.  */
+  if (prefix_maps == NULL)
+    return;
+
+  struct strings *strings = line_strp ? &dso->debug_line_str : &dso->debug_str;
+  struct stridxentry *entry = string_find_new_entry (strings, old_idx);
+  if (entry != NULL)
+    {
+      debug_section *sec = &debug_sections[line_strp
+					   ? DEBUG_LINE_STR : DEBUG_STR];
+      if (old_idx >= sec->size)
+	error (1, 0, "Bad string pointer index %zd (%s)", old_idx, sec->name);
+
+      const char *str = (char *)sec->data + old_idx;
+      Strent *strent = strtab_add_len (strings->str_tab,
+				       str, strlen (str) + 1);
+      if (strent == NULL)
+	error (1, ENOMEM, "Could not create new string table entry");
+      else
+	entry->entry = strent;
+    }
+}
+
+static void
+setup_strings (struct strings *strings)
+{
+  strings->str_tab = strtab_init (false);
+  strings->str_buf = NULL;
+  strings->blocks = NULL;
+  strings->last_block = NULL;
+  strings->entries = NULL;
+  strings->last_entries = NULL;
+  strings->strent_root = NULL;
+  strings->offs = NULL;
+  strings->noffs = 0;
+  strings->offs_map_size = 0;
+}
+
+/* Noop for tdestroy. */
+static void free_node (void *p __attribute__((__unused__))) { }
+
+static void
+destroy_strings (struct strings *strings)
+{
+  struct strmemblock *smb = strings->blocks;
+  while (smb != NULL)
+    {
+      void *old = smb;
+      smb = smb->next;
+      free (old);
+    }
+
+  struct strentblock *emb = strings->entries;
+  while (emb != NULL)
+    {
+      void *old = emb;
+      emb = emb->next;
+      free (old);
+    }
+
+  if (strings->str_tab != NULL)
+    strtab_free (strings->str_tab);
+  tdestroy (strings->strent_root, &free_node);
+  free (strings->str_buf);
+  if (strings->offs_map_size != 0)
+    munmap (strings->offs, strings->offs_map_size);
+  else
+    free (strings->offs);
+}
+
+/* Creates an unlinked temporary file in TMPDIR (or /tmp) to hold
+   NAME, so it doesn't take up memory.  */
+static int
+open_temp_file (const char *name)
+{
+  const char *tmpdir = getenv ("TMPDIR");
+  char *tmpl;
+  if (asprintf (&tmpl, "%s/debugedit.XXXXXX",
+		tmpdir != NULL ? tmpdir : "/tmp") < 0)
+    error (1, ENOMEM, "Could not create temporary file for '%s'", name);
+  int fd = mkstemp (tmpl);
+  if (fd < 0)
+    {
+      int err = errno;
+      free (tmpl);
+      error (1, err, "Could not create temporary file for '%s'", name);
+    }
+  unlink (tmpl);
+  free (tmpl);
+  return fd;
+}
+
+/* Where collect_stroff puts the next string offsets map entry.  */
+static __thread struct stroff *next_stroff;
+
+static void
+collect_stroff (const void *nodep, VISIT which,
+		int depth __attribute__ ((unused)))
+{
+  if (which == postorder || which == leaf)
+    {
+      const struct stridxentry *entry
+	= *(const struct stridxentry * const *) nodep;
+      next_stroff->old_idx = entry->idx;
+      next_stroff->new_idx = strent_offset (entry->entry);
+      next_stroff++;
+    }
+}
+
+/* Once the new string table has been finalized only the new offsets
+   of the old strings are needed.  Replace the index tree, the new
+   string table entries and the replacement strings by a sorted array
+   mapping old to new offsets, which is just a fraction of their size.
+   If the array is bigger than an eighth of the memory_limit it is
+   kept in a temporary file instead of in memory.  */
+static void
+compact_strings (struct strings *strings)
+{
+  size_t n = 0;
+  for (struct strentblock *emb = strings->entries; emb != NULL;
+       emb = emb->next)
+    n += emb->next != NULL ? STRIDXENTRIES : strings->entryidx;
+
+  size_t size = MAX (n, 1) * sizeof (struct stroff);
+  struct stroff *offs;
+  if (memory_limit != 0 && size > memory_limit / 8)
+    {
+      int fd = open_temp_file ("string offsets");
+      if (ftruncate (fd, size) != 0)
+	{
+	  int err = errno;
+	  close (fd);
+	  error (1, err, "Could not create string offsets file");
+	}
+      offs = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      int err = errno;
+      close (fd);
+      if (offs == MAP_FAILED)
+	error (1, err, "Could not map string offsets file");
+      strings->offs_map_size = size;
+    }
+  else
+    {
+      offs = malloc (size);
+      if (offs == NULL)
+	error (1, ENOMEM, "Couldn't allocate string offsets");
+    }
+
+  /* The tree is ordered by old index, so walking it sorts the map.  */
+  next_stroff = offs;
+  twalk (strings->strent_root, collect_stroff);
+  assert (next_stroff == offs + n);
+  strings->offs = offs;
+  strings->noffs = n;
+
+  tdestroy (strings->strent_root, &free_node);
+  strings->strent_root = NULL;
+
+  struct strentblock *emb = strings->entries;
+  while (emb != NULL)
+    {
+      void *old = emb;
+      emb = emb->next;
+      free (old);
+    }
+  strings->entries = NULL;
+  strings->last_entries = NULL;
+
+  struct strmemblock *smb = strings->blocks;
+  while (smb != NULL)
+    {
+      void *old = smb;
+      smb = smb->next;
+      free (old);
+    }
+  strings->blocks = NULL;
+  strings->last_block = NULL;
+
+  strtab_free (strings->str_tab);
+  strings->str_tab = NULL;
+}
+
+/* The minimum number of line tables we pre-allocate. */
+#define MIN_LINE_TABLES 64
+
+/* Gets a line_table at offset. Returns true if not yet know and
+   successfully read, false otherwise.  Sets *table to NULL and
+   outputs a warning if there was a problem reading the table at the
+   given offset.  */
+static bool
+get_line_table (DSO *dso, size_t off, struct line_table **table, struct CU *cu)
+{
+  struct debug_lines *lines = &dso->lines;
+  /* Assume there aren't that many, just do a linear search.  The
+     array is probably already sorted because the stmt_lists are
+     probably inserted in order. But we cannot rely on that (maybe we
+     should check that to make searching quicker if possible?).  Once
+     we have all line tables for phase 1 (rewriting) we do explicitly
+     sort the array.*/
+  for (int i = 0; i < lines->used; i++)
+    if (lines->table[i].old_idx == off)
+      {
+	*table = &lines->table[i];
+	return false;
+      }
+
+  if (lines->size == lines->used)
+    {
+      struct line_table *new_table = realloc (lines->table,
+					      (sizeof (struct line_table)
+					       * (lines->size
+						  + MIN_LINE_TABLES)));
+      if (new_table == NULL)
+	{
+	  error (0, ENOMEM, "Couldn't add more debug_line tables");
+	  *table = NULL;
+	  return false;
+	}
+      lines->table = new_table;
+      lines->size += MIN_LINE_TABLES;
+    }
+
+  struct line_table *t = &lines->table[lines->used];
+  *table = NULL;
+
+  t->cu = cu;
+  t->old_idx = off;
+  t->new_idx = off;
+  t->size_diff = 0;
+  t->replace_dirs = false;
+  t->replace_files = false;
+
+  unsigned char *ptr = debug_sections[DEBUG_LINE].data;
+  unsigned char *endsec = ptr + debug_sections[DEBUG_LINE].size;
+  if (ptr == NULL)
+    {
+      error (0, 0, "%s: No .line_table section", dso->filename);
+      return false;
+    }
+
+  if (off > debug_sections[DEBUG_LINE].size)
+    {
+      error (0, 0, "%s: Invalid .line_table offset 0x%zx",
+	     dso->filename, off);
+      return false;
+    }
+  ptr += off;
+
+  /* unit_length */
+  int offset_size;
+  t->unit_length = read_initial_length (ptr, offset_size);
+  t->offset_size = offset_size;
+  if (ptr > endsec
+      || (offset_size == 4 && t->unit_length >= 0xfffffff0)
+      || t->unit_length > (size_t) (endsec - ptr))
+    {
+      error (0, 0, "%s: .debug_line CU does not fit into section",
+	     dso->filename);
+      return false;
+    }
+  unsigned char *endcu = ptr + t->unit_length;
+
+  /* version */
+  t->version = read_16 (ptr);
+  if (t->version != 2 && t->version != 3 && t->version != 4 && t->version != 5)
+    {
+      error (0, 0, "%s: DWARF version %d unhandled", dso->filename,
+	     t->version);
+      return false;
+    }
+
+  if (t->version >= 5)
+    {
+      /* address_size */
+      assert (cu->ptr_size != 0);
+      if (cu->ptr_size != read_8 (ptr))
+	{
+	  error (0, 0, "%s: .debug_line address size differs from .debug_info",
+		 dso->filename);
+	  return false;
+	}
+
+      /* segment_selector_size */
+      (void) read_8 (ptr);
+    }
+
+  /* header_length */
+  t->header_length = (offset_size == 8 ? read_64 (ptr) : read_32 (ptr));
+  if (ptr > endcu || t->header_length > (size_t) (endcu - ptr))
+    {
+      error (0, 0, "%s: .debug_line CU prologue does not fit into CU",
+	     dso->filename);
+      return false;
+    }
+
+  /* min instr len */
+  t->min_instr_len = *ptr++;
+
+  /* max op per instr, if version >= 4 */
+  if (t->version >= 4)
+    t->max_op_per_instr = *ptr++;
+
+  /* default is stmt */
+  t->default_is_stmt = *ptr++;
+
+  /* line base */
+  t->line_base = (*(int8_t *)ptr++);
+
+  /* line range */
+  t->line_range = *ptr++;
+
+  /* opcode base */
+  t->opcode_base = *ptr++;
+
+  if (ptr + t->opcode_base - 1 >= endcu)
+    {
+      error (0, 0, "%s: .debug_line opcode table does not fit into CU",
+	     dso->filename);
+      return false;
+    }
+  lines->used++;
+  *table = t;
+  return true;
+}
+
+static __thread int dirty_elf;
+static void
+dirty_section (unsigned int sec)
+{
+  for (struct debug_section *secp = &debug_sections[sec]; secp != NULL;
+       secp = secp->next)
+    elf_flagdata (secp->elf_data, ELF_C_SET, ELF_F_DIRTY);
+  dirty_elf = 1;
+}
+
+static int
+line_table_cmp (const void *a, const void *b)
+{
+  struct line_table *ta = (struct line_table *) a;
+  struct line_table *tb = (struct line_table *) b;
+
+  if (ta->old_idx < tb->old_idx)
+    return -1;
+
+  if (ta->old_idx > tb->old_idx)
+    return 1;
+
+  return 0;
+}
+
+
+/* Defined below, needs skip_form.  */
+static void edit_dwarf5_line_entries (DSO *dso, unsigned char **optrp,
+				      unsigned char **ptrp,
+				      struct line_table *t, bool replace);
+
+/* Called after phase zero (which records all adjustments needed for
+   the line tables referenced from debug_info) and before phase one
+   starts (phase one will adjust the .debug_line section stmt
+   references using the updated data structures). */
+static void
+edit_dwarf2_line (DSO *dso)
+{
+  Elf_Data *linedata = debug_sections[DEBUG_LINE].elf_data;
+  unsigned char *old_buf = linedata->d_buf;
+
+  /* A nicer way to do this would be to set the original d_size to
+     zero and add a new Elf_Data section to contain the new data.
+     Out with the old. In with the new.
+
+  int linendx = debug_sections[DEBUG_LINE].sec;
+  Elf_Scn *linescn = dso->scn[linendx];
+  linedata->d_size = 0;
+  linedata = elf_newdata (linescn);
+
+    But when we then (recompress) the section there is a bug in
+    elfutils < 0.192 that causes the compression to fail/create bad
+    compressed data. So we just reuse the existing linedata (possibly
+    loosing track of the original d_buf, which will be overwritten).  */
+
+  dso->lines.line_buf = malloc (dso->lines.debug_lines_len);
+  if (dso->lines.line_buf == NULL)
+    error (1, ENOMEM, "No memory for new .debug_line table (0x%zx bytes)",
+	   dso->lines.debug_lines_len);
+
+  linedata->d_size = dso->lines.debug_lines_len;
+  linedata->d_buf = dso->lines.line_buf;
+  debug_sections[DEBUG_LINE].data = linedata->d_buf;
+  debug_sections[DEBUG_LINE].size = linedata->d_size;
+  debug_sections[DEBUG_LINE].elf_data = linedata;
+
+  /* Make sure the line tables are sorted on the old index. */
+  qsort (dso->lines.table, dso->lines.used, sizeof (struct line_table),
+	 line_table_cmp);
+
+  unsigned char *ptr = linedata->d_buf;
+  for (int ldx = 0; ldx < dso->lines.used; ldx++)
+    {
+      struct line_table *t = &dso->lines.table[ldx];
+      unsigned char *optr = old_buf + t->old_idx;
+      size_t length_size = INITIAL_LENGTH_SIZE (t->offset_size);
+      t->new_idx = ptr - (unsigned char *) linedata->d_buf;
+
+      /* Just copy the whole table if nothing needs replacing. */
+      if (! t->replace_dirs && ! t->replace_files)
+	{
+	  assert (t->size_diff == 0);
+	  memcpy (ptr, optr, t->unit_length + length_size);
+	  ptr += t->unit_length + length_size;
+	  continue;
+	}
+
+      /* Header fields. */
+      if (t->offset_size == 8)
+	{
+	  write_32 (ptr, 0xffffffff);
+	  write_64 (ptr, t->unit_length + t->size_diff);
+	}
+      else
+	write_32 (ptr, t->unit_length + t->size_diff);
+      write_16 (ptr, t->version);
+      if (t->version >= 5)
+	{
+	  /* address_size and segment_selector_size.  */
+	  memcpy (ptr, optr + length_size + 2, 2);
+	  ptr += 2;
+	}
+      if (t->offset_size == 8)
+	write_64 (ptr, t->header_length + t->size_diff);
+      else
+	write_32 (ptr, t->header_length + t->size_diff);
+      write_8 (ptr, t->min_instr_len);
+      if (t->version >= 4)
+	write_8 (ptr, t->max_op_per_instr);
+      write_8 (ptr, t->default_is_stmt);
+      write_8 (ptr, t->line_base);
+      write_8 (ptr, t->line_range);
+      write_8 (ptr, t->opcode_base);
+
+      optr += (length_size /* unit len */
+	       + 2 /* version */
+	       + (t->version >= 5 ? 2 : 0) /* address and segment size */
+	       + t->offset_size /* header len */
+	       + 1 /* min instr len */
+	       + (t->version >= 4) /* max op per instr, if version >= 4 */
+	       + 1 /* default is stmt */
+	       + 1 /* line base */
+	       + 1 /* line range */
+	       + 1); /* opcode base */
+
+      /* opcode len table. */
+      memcpy (ptr, optr, t->opcode_base - 1);
+      optr += t->opcode_base - 1;
+      ptr += t->opcode_base - 1;
+
+      if (t->version >= 5)
+	{
+	  /* directories and file names.  */
+	  edit_dwarf5_line_entries (dso, &optr, &ptr, t, t->replace_dirs);
+	  edit_dwarf5_line_entries (dso, &optr, &ptr, t, t->replace_files);
+	}
+      else
+	{
+	  /* directory table. We need to find the end (start of file
+	     table) anyway, so loop over all dirs, even if replace_dirs is
+	     false. */
+	  while (*optr != 0)
+	    {
+	      const char *dir = (const char *) optr;
+	      size_t dir_len;
+	      if (t->replace_dirs)
+		{
+		  const struct dir_prefix *dp = lookup_dir_prefix (dso, dir);
+		  dir_len = dp->len;
+		  if (dp->rest != -1)
+		    ptr = write_dest_dir_path (ptr, dp);
+		  else
+		    {
+		      memcpy (ptr, dir, dir_len + 1);
+		      ptr += dir_len + 1;
+		    }
+		}
+	      else
+		{
+		  dir_len = strlen (dir);
+		  memcpy (ptr, dir, dir_len + 1);
+		  ptr += dir_len + 1;
+		}
+
+	      optr += dir_len + 1;
+	    }
+	  optr++;
+	  *ptr++ = '\0';
+
+	  /* file table */
+	  if (t->replace_files)
+	    {
+	      while (*optr != 0)
+		{
+		  const char *file = (const char *) optr;
+		  const struct dir_prefix *dp = lookup_dir_prefix (dso, file);
+		  if (dp->rest != -1)
+		    ptr = write_dest_dir_path (ptr, dp);
+		  else
+		    {
+		      memcpy (ptr, file, dp->len + 1);
+		      ptr += dp->len + 1;
+		    }
+
+		  optr += dp->len + 1;
+
+		  /* dir idx, time, len */
+		  uint32_t dir_idx = read_uleb128 (optr);
+		  write_uleb128 (ptr, dir_idx);
+		  uint32_t time = read_uleb128 (optr);
+		  write_uleb128 (ptr, time);
+		  uint32_t len = read_uleb128 (optr);
+		  write_uleb128 (ptr, len);
+		}
+	      optr++;
+	      *ptr++ = '\0';
+	    }
+	}
+
+      /* line number program (and file table if not copied above). */
+      size_t remaining = (t->unit_length + length_size
+			  - (optr - (old_buf + t->old_idx)));
+      memcpy (ptr, optr, remaining);
+      ptr += remaining;
+    }
+  elf_flagdata (linedata, ELF_C_SET, ELF_F_DIRTY);
+}
+
+/* Record or adjust (according to phase) DW_FORM_strp or DW_FORM_line_strp.
+   Also handles DW_FORM_strx, but just for recording the (indexed) string.
+   OFFSET_SIZE is the offset size of the unit PTR is in.  */
+static void
+edit_strp (DSO *dso, uint32_t form, unsigned char *ptr, int phase,
+	   bool handled_strp, struct debug_section *sec, int offset_size,
+	   struct CU *cu)
+{
+  unsigned char *ptr_orig = ptr;
+
+  /* In the first pass we collect all strings, in the
+     second we put the new references back (if there are
+     any changes).  */
+  if (phase == 0)
+    {
+      /* handled_strp is set for attributes referring to
+	 files. If it is set the string is already
+	 recorded. */
+      if (! handled_strp)
+	{
+	  size_t idx = do_read_str_form_relocated (dso, form, ptr, sec,
+						   offset_size, cu);
+	  record_existing_string_entry_idx (form == DW_FORM_line_strp,
+					    dso, idx);
+	}
+    }
+  else if ((form == DW_FORM_strp
+	    || form == DW_FORM_line_strp) /* DW_FORM_strx stays the same.  */
+	   && (form == DW_FORM_line_strp
+	       ? need_line_strp_update : need_strp_update)) /* && phase == 1 */
+    {
+      size_t idx, new_idx;
+      struct strings *strings = (form == DW_FORM_line_strp
+				 ? &dso->debug_line_str : &dso->debug_str);
+      idx = do_read_offset_relocated (ptr, sec, offset_size);
+      new_idx = string_new_offset (strings, idx);
+      do_write_offset_relocated (ptr, new_idx, offset_size);
+    }
+
+  assert (ptr == ptr_orig);
+}
+
+/* Adjust *PTRP after the current *FORMP, update *FORMP for FORM_INDIRECT.
+   OFFSET_SIZE is the offset size of the unit *PTRP is in.  */
+static enum { FORM_OK, FORM_ERROR, FORM_INDIRECT }
+skip_form (DSO *dso, uint32_t *formp, unsigned char **ptrp, int offset_size,
+	   struct CU *cu)
+{
+  size_t len = 0;
+
+  switch (*formp)
+    {
+    case DW_FORM_ref_addr:
+      if (cu->cu_version == 2)
+	*ptrp += cu->ptr_size;
+      else
+	*ptrp += offset_size;
+      break;
+    case DW_FORM_flag_present:
+    case DW_FORM_implicit_const:
+      break;
+    case DW_FORM_addr:
+      *ptrp += cu->ptr_size;
+      break;
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+    case DW_FORM_data1:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+      ++*ptrp;
+      break;
+    case DW_FORM_ref2:
+    case DW_FORM_data2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+      *ptrp += 2;
+      break;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+      *ptrp += 3;
+      break;
+    case DW_FORM_ref4:
+    case DW_FORM_data4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+      *ptrp += 4;
+      break;
+    case DW_FORM_sec_offset:
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+      *ptrp += offset_size;
+      break;
+    case DW_FORM_ref8:
+    case DW_FORM_data8:
+    case DW_FORM_ref_sig8:
+      *ptrp += 8;
+      break;
+    case DW_FORM_data16:
+      *ptrp += 16;
+      break;
+    case DW_FORM_sdata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_udata:
+    case DW_FORM_strx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_addrx:
+      read_uleb128 (*ptrp);
+      break;
+    case DW_FORM_string:
+      *ptrp = (unsigned char *) strchr ((char *)*ptrp, '\0') + 1;
+      break;
+    case DW_FORM_indirect:
+      *formp = read_uleb128 (*ptrp);
+      return FORM_INDIRECT;
+    case DW_FORM_block1:
+      len = *(*ptrp)++;
+      break;
+    case DW_FORM_block2:
+      len = read_16 (*ptrp);
+      *formp = DW_FORM_block1;
+      break;
+    case DW_FORM_block4:
+      len = read_32 (*ptrp);
+      *formp = DW_FORM_block1;
+      break;
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+      len = read_uleb128 (*ptrp);
+      *formp = DW_FORM_block1;
+      if (len >= UINT_MAX)
+	{
+	  error (0, 0, "%s: Bad DWARF block length", dso->filename);
+	  return FORM_ERROR;
+	}
+      break;
+    default:
+      error (0, 0, "%s: Unknown DWARF DW_FORM_0x%x", dso->filename, *formp);
+      return FORM_ERROR;
+    }
+
+  if (*formp == DW_FORM_block1)
+    *ptrp += len;
+
+  return FORM_OK;
+}
+
+/* Part of read_dwarf2_line processing DWARF-5.  The directory and file
+   name entries at PTR can have DW_FORM_string paths (.debug_line.dwo
+   has no string sections to point into).  Calculate the new size of
+   the table when the paths under the prefix maps get replaced.  */
+static void
+size_dwarf5_line_strings (DSO *dso, unsigned char *ptr,
+			  struct line_table *table)
+{
+  /* First the directories, then the file names.  */
+  for (int files = 0; files < 2; files++)
+    {
+      unsigned format_count = read_8 (ptr);
+      unsigned char *formats = ptr;
+      for (unsigned formati = 0; formati < format_count; ++formati)
+	{
+	  read_uleb128 (ptr);
+	  read_uleb128 (ptr);
+	}
+
+      unsigned entry_count = read_uleb128 (ptr);
+      for (unsigned entryi = 0; entryi < entry_count; ++entryi)
+	{
+	  unsigned char *format_ptr = formats;
+	  for (unsigned formati = 0; formati < format_count; ++formati)
+	    {
+	      unsigned lnct = read_uleb128 (format_ptr);
+	      uint32_t form = read_uleb128 (format_ptr);
+	      if (lnct == DW_LNCT_path && form == DW_FORM_string)
+		{
+		  const struct dir_prefix *dp;
+		  dp = lookup_dir_prefix (dso, (const char *) ptr);
+		  if (dp->rest != -1)
+		    {
+		      table->size_diff += dp->new_size - (dp->len + 1);
+		      if (files)
+			table->replace_files = true;
+		      else
+			table->replace_dirs = true;
+		    }
+		}
+
+	      /* Bad forms are reported by read_dwarf5_line, just
+		 leave the table as is.  */
+	      if (skip_form (dso, &form, &ptr, table->offset_size,
+			     table->cu) != FORM_OK)
+		{
+		  table->size_diff = 0;
+		  table->replace_dirs = false;
+		  table->replace_files = false;
+		  return;
+		}
+	    }
+	}
+    }
+}
+
+/* Part of edit_dwarf2_line for DWARF-5.  Copies the directory or file
+   name entries at *OPTRP to *PTRP, replacing the DW_FORM_string paths
+   under the prefix maps if REPLACE.  Both pointers are moved past the
+   entries.  */
+static void
+edit_dwarf5_line_entries (DSO *dso, unsigned char **optrp,
+			  unsigned char **ptrp, struct line_table *t,
+			  bool replace)
+{
+  unsigned char *optr = *optrp;
+  unsigned char *ptr = *ptrp;
+
+  /* The formats and the number of entries stay the same.  */
+  unsigned format_count = read_8 (optr);
+  unsigned char *formats = optr;
+  for (unsigned formati = 0; formati < format_count; ++formati)
+    {
+      read_uleb128 (optr);
+      read_uleb128 (optr);
+    }
+  unsigned entry_count = read_uleb128 (optr);
+  memcpy (ptr, *optrp, optr - *optrp);
+  ptr += optr - *optrp;
+
+  for (unsigned entryi = 0; entryi < entry_count; ++entryi)
+    {
+      unsigned char *format_ptr = formats;
+      for (unsigned formati = 0; formati < format_count; ++formati)
+	{
+	  unsigned lnct = read_uleb128 (format_ptr);
+	  uint32_t form = read_uleb128 (format_ptr);
+	  if (replace && lnct == DW_LNCT_path && form == DW_FORM_string)
+	    {
+	      const struct dir_prefix *dp;
+	      dp = lookup_dir_prefix (dso, (const char *) optr);
+	      if (dp->rest != -1)
+		{
+		  ptr = write_dest_dir_path (ptr, dp);
+		  optr += dp->len + 1;
+		  continue;
+		}
+	    }
+
+	  /* Already checked by size_dwarf5_line_strings.  */
+	  unsigned char *value = optr;
+	  skip_form (dso, &form, &optr, t->offset_size, t->cu);
+	  memcpy (ptr, value, optr - value);
+	  ptr += optr - value;
+	}
+    }
+
+  *optrp = optr;
+  *ptrp = ptr;
+}
+
+/* The same (comp_dir, dir, file) triples show up in the line tables
+   of lots of CUs.  Remember which ones list_source_file already
+   handled, so repeats cost just a hash lookup.  */
+struct source_file
+{
+  hashval_t hash;
+  const char *comp_dir;
+  const char *dir;
+  const char *file;
+};
+
+static __thread htab_t source_files;
+
+static hashval_t
+source_file_hash (const void *p)
+{
+  return ((const struct source_file *) p)->hash;
+}
+
+static int
+source_file_eq (const void *p, const void *q)
+{
+  const struct source_file *s1 = (const struct source_file *) p;
+  const struct source_file *s2 = (const struct source_file *) q;
+
+  return (s1->hash == s2->hash
+	  && strcmp (s1->file, s2->file) == 0
+	  && strcmp (s1->dir, s2->dir) == 0
+	  && strcmp (s1->comp_dir, s2->comp_dir) == 0);
+}
+
+/* Add source FILE from directory DIR of a CU with COMP_DIR (which
+   might be NULL) to the list file.  The path is made relative to
+   base_dir (or dest_dir) when given, files outside those aren't
+   listed.  Returns false when out of memory.  */
+static bool
+list_source_file (DSO *dso, const char *comp_dir, const char *dir,
+		  const char *file)
+{
+  if (comp_dir == NULL)
+    comp_dir = "";
+  size_t comp_dir_len = strlen (comp_dir);
+  size_t file_len = strlen (file);
+  size_t dir_len = strlen (dir);
+
+  struct source_file key = { .comp_dir = comp_dir, .dir = dir,
+			     .file = file };
+  key.hash = iterative_hash (file, file_len + 1, 0);
+  key.hash = iterative_hash (dir, dir_len + 1, key.hash);
+  key.hash = iterative_hash (comp_dir, comp_dir_len + 1, key.hash);
+
+  if (source_files == NULL)
+    {
+      source_files = htab_try_create (1024, source_file_hash,
+				      source_file_eq, free);
+      if (source_files == NULL)
+	return false;
+    }
+  /* Already listed (or known not to be listed).  */
+  if (htab_find_with_hash (source_files, &key, key.hash) != NULL)
+    return true;
+
+  struct arena_mark mark = arena_mark (&dso->arena);
+  char *s = arena_alloc (&dso->arena,
+			 comp_dir_len + 1 + file_len + 1 + dir_len + 1);
+  if (s == NULL)
+    return false;
+  if (file[0] == '/')
+    {
+      memcpy (s, file, file_len + 1);
+    }
+  else if (dir[0] == '/')
+    {
+      memcpy (s, dir, dir_len);
+      s[dir_len] = '/';
+      memcpy (s + dir_len + 1, file, file_len + 1);
+    }
+  else
+    {
+      char *p = s;
+      if (comp_dir_len != 0)
+	{
+	  memcpy (s, comp_dir, comp_dir_len);
+	  s[comp_dir_len] = '/';
+	  p += comp_dir_len + 1;
+	}
+      memcpy (p, dir, dir_len);
+      p[dir_len] = '/';
+      memcpy (p + dir_len + 1, file, file_len + 1);
+    }
+  canonicalize_path (s, s);
+
+  const char *p = NULL;
+  if (base_dir == NULL)
+    p = s;
+  else
+    {
+      p = skip_dir_prefix (s, base_dir);
+      if (p == NULL && dest_dir != NULL)
+	p = skip_dir_prefix (s, dest_dir);
+    }
+
+  if (p)
+    list_file_add (p, false);
+
+  /* Remember the triple, with all strings in one block.  */
+  struct source_file *sf = malloc (sizeof (struct source_file)
+				   + comp_dir_len + 1 + dir_len + 1
+				   + file_len + 1);
+  if (sf == NULL)
+    {
+      arena_release (&dso->arena, mark);
+      return false;
+    }
+  char *d = (char *) (sf + 1);
+  sf->hash = key.hash;
+  sf->comp_dir = memcpy (d, comp_dir, comp_dir_len + 1);
+  d += comp_dir_len + 1;
+  sf->dir = memcpy (d, dir, dir_len + 1);
+  d += dir_len + 1;
+  sf->file = memcpy (d, file, file_len + 1);
+  arena_release (&dso->arena, mark);
+
+  void **slot = htab_find_slot_with_hash (source_files, sf, sf->hash,
+					  INSERT);
+  if (slot == NULL)
+    {
+      free (sf);
+      return false;
+    }
+  *slot = sf;
+  return true;
+}
+
+/* Part of read_dwarf2_line processing DWARF-4.  */
+static bool
+read_dwarf4_line (DSO *dso, unsigned char *ptr, char *comp_dir,
+		  struct line_table *table)
+{
+  unsigned char **dirt;
+  uint32_t value, dirt_cnt;
+  unsigned char *dir = ptr;
+
+  /* dir table: */
+  value = 1;
+  while (*ptr != 0)
+    {
+      if (prefix_maps != NULL)
+	{
+	  /* Do we need to replace any of the dirs? Calculate new size. */
+	  const struct dir_prefix *dp = lookup_dir_prefix (dso,
+							   (const char *) ptr);
+	  if (dp->rest != -1)
+	    {
+	      table->size_diff += dp->new_size - (dp->len + 1);
+	      table->replace_dirs = true;
+	    }
+	}
+
+      ptr = (unsigned char *) strchr ((char *)ptr, 0) + 1;
+      ++value;
+    }
+
+  dirt = (unsigned char **) alloca (value * sizeof (unsigned char *));
+  dirt[0] = (unsigned char *) ".";
+  dirt_cnt = 1;
+  ptr = dir;
+  while (*ptr != 0)
+    {
+      dirt[dirt_cnt++] = ptr;
+      ptr = (unsigned char *) strchr ((char *)ptr, 0) + 1;
+    }
+  ptr++;
+
+  /* file table: */
+  while (*ptr != 0)
+    {
+      char *file;
+
+      file = (char *) ptr;
+      ptr = (unsigned char *) strchr ((char *)ptr, 0) + 1;
+      value = read_uleb128 (ptr);
+
+      if (value >= dirt_cnt)
+	{
+	  error (0, 0, "%s: Wrong directory table index %u",
+		 dso->filename, value);
+	  return false;
+	}
+      if (prefix_maps != NULL)
+	{
+	  /* Do we need to replace any of the files? Calculate new size. */
+	  const struct dir_prefix *dp = lookup_dir_prefix (dso, file);
+	  if (dp->rest != -1)
+	    {
+	      table->size_diff += dp->new_size - (dp->len + 1);
+	      table->replace_files = true;
+	    }
+	}
+      if (list_file_fd != -1
+	  && ! list_source_file (dso, comp_dir, (char *) dirt[value], file))
+	{
+	  error (0, ENOMEM, "%s: Reading file table", dso->filename);
+	  return false;
+	}
+
+      read_uleb128 (ptr);
+      read_uleb128 (ptr);
+    }
+
+  return true;
+}
+
+/* Called by read_dwarf5_line first for directories and then file
+   names as they both have the same format.  */
+static bool
+read_dwarf5_line_entries (DSO *dso, unsigned char **ptrp,
+			  struct line_table *table, int phase,
+			  char ***dirs, int *ndir,
+			  const char *entry_name)
+{
+  /* directory_entry_format_count */
+  /* file_name_entry_format_count */
+  unsigned format_count = read_8 (*ptrp);
+
+  unsigned char *formats = *ptrp;
+
+  /* directory_entry_format */
+  /* file_name_entry_format */
+  for (unsigned formati = 0; formati < format_count; ++formati)
+    {
+      read_uleb128 (*ptrp);
+      read_uleb128 (*ptrp);
+    }
+
+  /* directories_count */
+  /* file_names_count */
+  unsigned entry_count = read_uleb128 (*ptrp);
+
+  bool collecting_dirs = phase == 0 && *dirs == NULL;
+  bool writing_files = phase == 0 && *dirs != NULL;
+  if (collecting_dirs)
+    {
+      *ndir = entry_count;
+      *dirs = arena_alloc (&dso->arena, entry_count * sizeof (char *));
+      if (*dirs == NULL)
+	error (1, errno, "%s: Could not allocate debug_line dirs",
+	       dso->filename);
+    }
+
+  /* directories */
+  /* file_names */
+  for (unsigned entryi = 0; entryi < entry_count; ++entryi)
+    {
+      char *dir = NULL;
+      char *file = NULL;;
+      unsigned char *format_ptr = formats;
+      for (unsigned formati = 0; formati < format_count; ++formati)
+	{
+	  unsigned lnct = read_uleb128 (format_ptr);
+	  unsigned form = read_uleb128 (format_ptr);
+	  bool handled_form = false;
+	  bool handled_strp = false;
+	  bool line_strp = form == DW_FORM_line_strp;
+	  if (lnct == DW_LNCT_path)
+	    {
+	      switch (form)
+		{
+		case DW_FORM_strp:
+		case DW_FORM_line_strp:
+		  if (phase == 0)
+		    {
+		      debug_section *debug_sec = &debug_sections[DEBUG_LINE];
+		      size_t idx = do_read_offset_relocated (*ptrp, debug_sec,
+							     table->offset_size);
+		      if (prefix_maps != NULL)
+			{
+			  if (record_file_string_entry_idx (line_strp, dso,
+							    idx))
+			    {
+			      if (line_strp)
+				need_line_strp_update = true;
+			      else
+				need_strp_update = true;
+			    }
+			}
+		      handled_strp = true;
+		      if (collecting_dirs || writing_files)
+			{
+			  debug_section *sec = &debug_sections[line_strp
+                                           ? DEBUG_LINE_STR : DEBUG_STR];
+			  if (collecting_dirs)
+			    dir = (char *)sec->data + idx;
+			  if (writing_files)
+			    file = (char *)sec->data + idx;
+			}
+		    }
+		  break;
+		case DW_FORM_string:
+		  /* Inline, edit_dwarf2_line already replaced it if needed.  */
+		  if (collecting_dirs)
+		    dir = (char *) *ptrp;
+		  if (writing_files)
+		    file = (char *) *ptrp;
+		  break;
+		default:
+		  error (0, 0, "%s: Unsupported "
+			 ".debug_line %s %u path DW_FORM_0x%x",
+			 dso->filename, entry_name, entryi, form);
+		  return false;
+		}
+	    }
+	  if (writing_files && lnct == DW_LNCT_directory_index)
+	    {
+	      int dirndx;
+	      switch (form)
+		{
+		case DW_FORM_udata:
+		  handled_form = true;
+		  dirndx = read_uleb128 (*ptrp);
+		  break;
+		case DW_FORM_data1:
+		  dirndx = **ptrp;
+		  break;
+		case DW_FORM_data2:
+		  dirndx = do_read_16 (*ptrp);
+		  break;
+		case DW_FORM_data4:
+		  dirndx = do_read_32 (*ptrp);
+		  break;
+		default:
+		  error (0, 0, "%s: Unsupported "
+			 ".debug_line %s %u dirndx DW_FORM_0x%x",
+			 dso->filename, entry_name, entryi, form);
+		  return false;
+		}
+
+	      if (dirndx > *ndir)
+		{
+		  error (0, 0, "%s: Bad dir number %u in .debug_line %s",
+			 dso->filename, entryi, entry_name);
+		  return false;
+		}
+	      dir = (*dirs)[dirndx];
+	    }
+
+	  switch (form)
+	    {
+	    case DW_FORM_strp:
+	    case DW_FORM_line_strp:
+	    case DW_FORM_strx:
+	    case DW_FORM_strx1:
+	    case DW_FORM_strx2:
+	    case DW_FORM_strx3:
+	    case DW_FORM_strx4:
+	      edit_strp (dso, form, *ptrp, phase, handled_strp,
+			 &debug_sections[DEBUG_LINE], table->offset_size,
+			 table->cu);
+	      break;
+	    }
+
+	  if (!handled_form)
+	    {
+	      switch (skip_form (dso, &form, ptrp, table->offset_size,
+				 table->cu))
+		{
+		case FORM_OK:
+		  break;
+		case FORM_ERROR:
+		  return false;
+		case FORM_INDIRECT:
+		  error (0, 0, "%s: Unsupported "
+			 ".debug_line %s %u DW_FORM_indirect",
+			 dso->filename, entry_name, entryi);
+		  return false;
+		}
+	    }
+	}
+
+      if (collecting_dirs)
+	(*dirs)[entryi] = dir;
+
+      if (writing_files && list_file_fd != -1
+	  && ! list_source_file (dso, (*dirs)[0], dir, file))
+	{
+	  error (0, ENOMEM, "%s: Reading file table", dso->filename);
+	  return false;
+	}
+    }
+
+  return true;
+}
+
+/* Part of read_dwarf2_line processing DWARF-5.  */
+static bool
+read_dwarf5_line (DSO *dso, unsigned char *ptr, struct line_table *table,
+		  int phase)
+{
+  char **dirs = NULL;
+  int ndir;
+  struct arena_mark mark = arena_mark (&dso->arena);
+  /* Skip header.  */
+  ptr += (INITIAL_LENGTH_SIZE (table->offset_size) /* unit len */
+          + 2 /* version */
+          + (table->version < 5 ? 0 : 0
+             + 1 /* address_size */
+             + 1 /* segment_selector*/)
+          + table->offset_size /* header len */
+          + 1 /* min instr len */
+          + (table->version >= 4) /* max op per instr, if version >= 4 */
+          + 1 /* default is stmt */
+          + 1 /* line base */
+          + 1 /* line range */
+          + 1 /* opcode base */
+          + table->opcode_base - 1); /* opcode len table */
+
+  bool retval = (read_dwarf5_line_entries (dso, &ptr, table, phase,
+					   &dirs, &ndir, "directory")
+		 && read_dwarf5_line_entries (dso, &ptr, table, phase,
+					      &dirs, &ndir, "file name"));
+  arena_release (&dso->arena, mark);
+  return retval;
+}
+
+/* Called during phase zero for each debug_line table referenced from
+   .debug_info.  Outputs all source files seen and records any
+   adjustments needed in the debug_list data structures. Returns true
+   if line_table needs to be rewrite either the dir or file paths. */
+static bool
+read_dwarf2_line (DSO *dso, size_t off, char *comp_dir, struct CU *cu)
+{
+  unsigned char *ptr;
+  struct line_table *table;
+
+  if (get_line_table (dso, off, &table, cu) == false
+      || table == NULL)
+    return false;
+
+  /* Skip to the directory table. The rest of the header has already
+     been read and checked by get_line_table. */
+  ptr = debug_sections[DEBUG_LINE].data + off;
+  ptr += (INITIAL_LENGTH_SIZE (table->offset_size) /* unit len */
+	  + 2 /* version */
+	  + (table->version < 5 ? 0 : 0
+	     + 1 /* address_size */
+	     + 1 /* segment_selector*/)
+	  + table->offset_size /* header len */
+	  + 1 /* min instr len */
+	  + (table->version >= 4) /* max op per instr, if version >= 4 */
+	  + 1 /* default is stmt */
+	  + 1 /* line base */
+	  + 1 /* line range */
+	  + 1 /* opcode base */
+	  + table->opcode_base - 1); /* opcode len table */
+
+  /* DWARF version 5 line tables only change size for DW_FORM_string
+     paths. But they might need [line]strp recording/updates. Handle
+     that part later.  */
+  if (table->version < 5)
+    {
+      if (! read_dwarf4_line (dso, ptr, comp_dir, table))
+	return false;
+    }
+  else if (prefix_maps != NULL)
+    size_dwarf5_line_strings (dso, ptr, table);
+
+  dso->lines.debug_lines_len += (INITIAL_LENGTH_SIZE (table->offset_size)
+				 + table->unit_length + table->size_diff);
+  return table->replace_dirs || table->replace_files;
+}
+
+/* Called during phase one, after the table has been sorted.  Returns
+   NULL if there is no line table at IDX.  */
+static struct line_table *
+find_line_table (struct debug_lines *lines, size_t idx)
+{
+  struct line_table key;
+  key.old_idx = idx;
+  return bsearch (&key, lines->table, lines->used,
+		  sizeof (struct line_table), line_table_cmp);
+}
+
+/* Called during phase one, after the table has been sorted. */
+static size_t
+find_new_list_offs (struct debug_lines *lines, size_t idx)
+{
+  struct line_table *table = find_line_table (lines, idx);
+  return table->new_idx;
+}
+
+/* Read DW_FORM_strp or DW_FORM_line_strp collecting compilation directory.  */
+static void
+edit_attributes_str_comp_dir (uint32_t form, DSO *dso, unsigned char **ptrp,
+			      int phase, char **comp_dirp, bool *handled_strpp,
+			      struct debug_section *debug_sec, struct CU *cu)
+{
+  const char *dir;
+  size_t idx = do_read_str_form_relocated (dso, form, *ptrp, debug_sec,
+					   cu->offset_size, cu);
+  bool line_strp = form == DW_FORM_line_strp;
+  /* In phase zero we collect the comp_dir.  */
+  if (phase == 0)
+    {
+      debug_section *sec = &debug_sections[line_strp
+					   ? DEBUG_LINE_STR : DEBUG_STR];
+      if (sec->data == NULL || idx >= sec->size)
+	error (1, 0, "%s: Bad string pointer index %zd for comp_dir (%s)",
+	       dso->filename, idx, sec->name);
+      dir = (char *) sec->data + idx;
+
+      *comp_dirp = arena_strdup (&dso->arena, dir);
+    }
+
+  if (prefix_maps != NULL && phase == 0)
+    {
+      if (record_file_string_entry_idx (line_strp, dso, idx))
+	{
+	  if (line_strp)
+	    need_line_strp_update = true;
+	  else
+	    need_strp_update = true;
+	}
+      *handled_strpp = true;
+    }
+}
+
+/* This scans the attributes of one DIE described by the given abbrev_tag.
+   PTR points to the data in the debug_info. It will be advanced till all
+   abbrev data is consumed. In phase zero data is collected, in phase one
+   data might be replaced/updated.  */
+static unsigned char *
+edit_attributes (DSO *dso, unsigned char *ptr, struct abbrev_tag *t, int phase,
+		 struct debug_section *debug_sec, struct CU *cu)
+{
+  int i;
+  size_t list_offs;
+  int found_list_offs;
+  char *comp_dir;
+
+  comp_dir = NULL;
+  list_offs = 0;
+  found_list_offs = 0;
+  for (i = 0; i < t->nattr; ++i)
+    {
+      uint32_t form = t->attr[i].form;
+      while (1)
+	{
+	  /* Whether we already handled a string as file for this
+	     attribute.  If we did then we don't need to handle/record
+	     it again when handling the DW_FORM_strp later. */
+	  bool handled_strp = false;
+
+	  /* A stmt_list points into the .debug_line section.  In
+	     phase zero record all offsets. Then in phase one replace
+	     them with the new offsets if we rewrote the line
+	     tables.  */
+	  if (t->attr[i].attr == DW_AT_stmt_list)
+	    {
+	      if (form == DW_FORM_data4
+		  || form == DW_FORM_sec_offset)
+		{
+		  int size = form == DW_FORM_data4 ? 4 : cu->offset_size;
+		  list_offs = do_read_offset_relocated (ptr, debug_sec, size);
+		  if (phase == 0)
+		    found_list_offs = 1;
+		  else if (need_stmt_update) /* phase one */
+		    {
+		      size_t idx, new_idx;
+		      idx = do_read_offset_relocated (ptr, debug_sec, size);
+		      new_idx = find_new_list_offs (&dso->lines, idx);
+		      do_write_offset_relocated (ptr, new_idx, size);
+		    }
+		}
+	    }
+
+	  if (t->attr[i].attr == DW_AT_macros)
+	    {
+	      int size = form == DW_FORM_sec_offset ? cu->offset_size : 4;
+	      cu->macros_offs = (cu->macro_base
+				 + do_read_offset_relocated (ptr, debug_sec,
+							     size));
+	    }
+
+	  /* DW_AT_comp_dir is the current working directory. */
+	  if (t->attr[i].attr == DW_AT_comp_dir)
+	    {
+	      if (form == DW_FORM_string)
+		{
+		  comp_dir = arena_strdup (&dso->arena, (char *)ptr);
+
+		  if (prefix_maps != NULL)
+		    {
+		      /* In phase zero we are just collecting dir/file
+			 names and check whether any need to be
+			 adjusted. If so, in phase one we replace
+			 those dir/files.  */
+		      const char *file;
+		      const struct prefix_map *map;
+		      map = find_prefix_map (comp_dir, &file);
+		      if (map != NULL && phase == 0)
+			need_string_replacement = true;
+		      else if (map != NULL && phase == 1)
+			{
+			  size_t orig_len = strlen (comp_dir);
+			  size_t dest_len = map->new_len;
+			  size_t file_len = strlen (file);
+			  size_t new_len = dest_len;
+			  if (file_len > 0)
+			    new_len += 1 + file_len; /* + '/' */
+
+			  /* We don't want to rewrite the whole
+			     debug_info section, so we only replace
+			     the comp_dir with something equal or
+			     smaller, possibly adding some slashes
+			     at the end of the new compdir.  This
+			     normally doesn't happen since most
+			     producers will use DW_FORM_strp which is
+			     more efficient.  */
+			  if (orig_len < new_len)
+			    error (0, 0, "Warning, not replacing comp_dir "
+				   "'%s' prefix ('%s' -> '%s') encoded as "
+				   "DW_FORM_string. "
+				   "Replacement too large.",
+				   comp_dir, map->old, map->new);
+			  else
+			    {
+			      /* Add zero (if no file part), one or more
+				 slashes in between the new path and the
+				 file name to fill up all space (replacement
+				 DW_FORM_string must be of the same length).
+				 We don't need to copy the old file name (if
+				 any) or the zero terminator, because those
+				 are already at the end of the string.  */
+			      memcpy (ptr, map->new, dest_len);
+			      memset (ptr + dest_len, '/',
+				      orig_len - new_len);
+			    }
+			}
+		    }
+		}
+	      else if (form == DW_FORM_strp
+		       || form == DW_FORM_line_strp
+		       || form == DW_FORM_strx
+		       || form == DW_FORM_strx1
+		       || form == DW_FORM_strx2
+		       || form == DW_FORM_strx3
+		       || form == DW_FORM_strx4)
+		edit_attributes_str_comp_dir (form, dso,
+					      &ptr, phase, &comp_dir,
+					      &handled_strp, debug_sec, cu);
+	    }
+	  else if ((t->tag == DW_TAG_compile_unit
+		    || t->tag == DW_TAG_partial_unit)
+		   && ((form == DW_FORM_strp
+			&& debug_sections[DEBUG_STR].data)
+		       || (form == DW_FORM_line_strp
+			   && debug_sections[DEBUG_LINE_STR].data)
+		       || ((form == DW_FORM_strx
+			    || form == DW_FORM_strx1
+			    || form == DW_FORM_strx2
+			    || form == DW_FORM_strx3
+			    || form == DW_FORM_strx4)
+			   && debug_sections[DEBUG_STR_OFFSETS].data))
+		   && t->attr[i].attr == DW_AT_name)
+	    {
+	      bool line_strp = form == DW_FORM_line_strp;
+
+	      /* DW_AT_name is the primary file for this compile
+		 unit. If starting with / it is a full path name.
+		 Note that we don't handle DW_FORM_string in this
+		 case.  */
+	      size_t idx = do_read_str_form_relocated (dso, form, ptr,
+						       debug_sec,
+						       cu->offset_size, cu);
+
+	      /* In phase zero we will look for a comp_dir to use.  */
+	      if (phase == 0)
+		{
+		  debug_section *sec = &debug_sections[line_strp
+						       ? DEBUG_LINE_STR
+						       : DEBUG_STR];
+		  if (idx >= sec->size)
+		    error (1, 0,
+			   "%s: Bad string pointer index %zd for unit name (%s)",
+			   dso->filename, idx, sec->name);
+		  char *name = (char *) sec->data + idx;
+		  if (*name == '/' && comp_dir == NULL)
+		    {
+		      char *enddir = strrchr (name, '/');
+
+		      if (enddir != name)
+			{
+			  comp_dir = arena_alloc (&dso->arena,
+						  enddir - name + 1);
+			  memcpy (comp_dir, name, enddir - name);
+			  comp_dir [enddir - name] = '\0';
+			}
+		      else
+			comp_dir = arena_strdup (&dso->arena, "/");
+		    }
+		}
+
+	      /* First pass (0) records the new name to be
+		 added to the debug string pool, the second
+		 pass (1) stores it (the new index). */
+	      if (prefix_maps != NULL && phase == 0)
+		{
+		  if (record_file_string_entry_idx (line_strp, dso, idx))
+		    {
+		      if (line_strp)
+			need_line_strp_update = true;
+		      else
+			need_strp_update = true;
+		    }
+		  handled_strp = true;
+		}
+	    }
+
+	  switch (form)
+	    {
+	    case DW_FORM_strp:
+	    case DW_FORM_line_strp:
+	    case DW_FORM_strx:
+	    case DW_FORM_strx1:
+	    case DW_FORM_strx2:
+	    case DW_FORM_strx3:
+	    case DW_FORM_strx4:
+	      edit_strp (dso, form, ptr, phase, handled_strp, debug_sec,
+			 cu->offset_size, cu);
+	      break;
+	    }
+
+	  switch (skip_form (dso, &form, &ptr, cu->offset_size, cu))
+	    {
+	    case FORM_OK:
+	      break;
+	    case FORM_ERROR:
+	      return NULL;
+	    case FORM_INDIRECT:
+	      continue;
+	    }
+
+	  break;
+	}
+    }
+
+  /* Ensure the CU current directory will exist even if only empty.  Source
+     filenames possibly located in its parent directories refer relatively to
+     it and the debugger (GDB) cannot safely optimize out the missing
+     CU current dir subdirectories.  Only do this once in phase one. And
+     only do this for dirs under our build/base_dir.  Don't output the
+     empty string (in case the comp_dir == base_dir).  */
+  if (phase == 0 && base_dir && comp_dir && list_file_fd != -1)
+    {
+      const char *p = skip_dir_prefix (comp_dir, base_dir);
+      /* Output trailing dir separator to distinguish them quickly from
+	 regular files. */
+      if (p != NULL && p[0] != '\0')
+	list_file_add (p, true);
+    }
+
+  /* Split units use the line table at the start of their
+     .debug_line.dwo contribution without a DW_AT_stmt_list.  It goes
+     with the first DIE, which has the comp_dir.  */
+  if (phase == 0 && cu->implicit_line)
+    {
+      cu->implicit_line = false;
+      list_offs = cu->line_base;
+      found_list_offs = 1;
+    }
+
+  /* In phase zero we collect all file names (we need the comp_dir for
+     that).  Note that calculating the new size and offsets is done
+     separately (at the end of phase zero after all CUs have been
+     scanned in dwarf2_edit). */
+  if (phase == 0 && found_list_offs
+      && read_dwarf2_line (dso, list_offs, comp_dir, cu))
+    need_stmt_update = true;
+
+  return ptr;
+}
+
+static int
+line_rel_cmp (const void *a, const void *b)
+{
+  LINE_REL *rela = (LINE_REL *) a, *relb = (LINE_REL *) b;
+
+  if (rela->r_offset < relb->r_offset)
+    return -1;
+
+  if (rela->r_offset > relb->r_offset)
+    return 1;
+
+  return 0;
+}
+
+/* The line table programs will be moved forward/backwards a bit in
+   the new .debug_line data by edit_dwarf2_line.  Update the
+   .debug_line relocations (these only happen in ET_REL files and are
+   section offsets) to the new offsets.  Both the relocations and the
+   line tables are walked in offset order, so this is a single merge
+   pass, writing the new offsets straight into the relocation data.  */
+static void
+update_line_relocs (DSO *dso)
+{
+  int rndx = debug_sections[DEBUG_LINE].relsec;
+  if (rndx == 0)
+    return;
+
+  check_rel_entsize (dso, rndx, debug_sections[DEBUG_LINE].name);
+  bool is64 = gelf_getclass (dso->elf) == ELFCLASS64;
+  Elf_Data *rdata = elf_getdata (dso->scn[rndx], NULL);
+  int rtype = dso->shdr[rndx].sh_type;
+  size_t rels = dso->shdr[rndx].sh_size / dso->shdr[rndx].sh_entsize;
+  LINE_REL *rbuf = malloc (rels * sizeof (LINE_REL));
+  if (rbuf == NULL)
+    error (1, errno, "%s: Could not allocate line relocations",
+	   dso->filename);
+
+  bool sorted = true;
+  for (size_t i = 0; i < rels; i++)
+    {
+      GElf_Rela rela;
+      get_rel (is64, rtype, rdata, i, &rela);
+      rbuf[i].r_offset = rela.r_offset;
+      rbuf[i].ndx = i;
+      if (i > 0 && rela.r_offset < rbuf[i - 1].r_offset)
+	sorted = false;
+    }
+  if (! sorted)
+    qsort (rbuf, rels, sizeof (LINE_REL), line_rel_cmp);
+
+  size_t lndx = 0;
+  for (size_t i = 0; i < rels; i++)
+    {
+      GElf_Addr r_offset = rbuf[i].r_offset;
+      struct line_table *t;
+
+      while (lndx < dso->lines.used
+	     && r_offset > (dso->lines.table[lndx].old_idx
+			    + INITIAL_LENGTH_SIZE (dso->lines.table[lndx]
+						   .offset_size)
+			    + dso->lines.table[lndx].unit_length))
+	lndx++;
+
+      if (lndx >= dso->lines.used)
+	{
+	  free (rbuf);
+	  error (1, 0, ".debug_line relocation offset out of range");
+	}
+
+      /* Offset (pointing into the line program) moves from old to
+	 new index including the header size diff. */
+      t = &dso->lines.table[lndx];
+      r_offset += (ssize_t)((t->new_idx - t->old_idx) + t->size_diff);
+      set_rel_offset (is64, rtype, rdata, rbuf[i].ndx, r_offset);
+    }
+
+  elf_flagdata (rdata, ELF_C_SET, ELF_F_DIRTY);
+  free (rbuf);
+}
+
+/* Maps the data of section SCNDX read-only from the file for SEC,
+   instead of reading it all into memory through libelf, so phase 0
+   can scan it in windows and give back the pages it is done with, see
+   release_debug_section.  Returns false if the section cannot be
+   mapped, the libelf data should be used then.  */
+static bool
+map_debug_section (DSO *dso, struct debug_section *sec, int scndx)
+{
+  const GElf_Shdr *shdr = &dso->shdr[scndx];
+  struct stat st;
+
+  if (shdr->sh_type != SHT_PROGBITS
+      || fstat (dso->fd, &st) != 0
+      || shdr->sh_offset > (uint64_t) st.st_size
+      || shdr->sh_size > (uint64_t) st.st_size - shdr->sh_offset)
+    return false;
+
+  off_t pagesize = sysconf (_SC_PAGESIZE);
+  off_t start = shdr->sh_offset & ~(pagesize - 1);
+  size_t delta = shdr->sh_offset - start;
+  size_t map_size = delta + shdr->sh_size;
+  void *map = mmap (NULL, map_size, PROT_READ, MAP_PRIVATE, dso->fd, start);
+  if (map == MAP_FAILED)
+    return false;
+  madvise (map, map_size, MADV_SEQUENTIAL);
+
+  sec->map = map;
+  sec->map_size = map_size;
+  sec->map_released = map;
+  sec->data = sec->map + delta;
+  sec->elf_data = NULL;
+  sec->size = shdr->sh_size;
+  sec->sec = scndx;
+  return true;
+}
+
+/* Gives back the pages of the phase 0 mapping of SEC before END once
+   they add up to an eighth of the memory_limit.  These are clean file
+   pages, anything that still looks at them just reads them in again.  */
+static void
+release_debug_section (struct debug_section *sec, unsigned char *end)
+{
+  size_t pagesize = sysconf (_SC_PAGESIZE);
+  unsigned char *page = sec->map + ((end - sec->map) & ~(pagesize - 1));
+  if ((size_t) (page - sec->map_released) >= MAX (memory_limit / 8,
+						  pagesize))
+    {
+      madvise (sec->map_released, page - sec->map_released, MADV_DONTNEED);
+      sec->map_released = page;
+    }
+}
+
+/* Replaces the phase 0 mapping of SEC by the libelf section data,
+   which phase 1 edits in place and elf_update writes out.  */
+static void
+load_debug_section (DSO *dso, struct debug_section *sec)
+{
+  Elf_Data *data = section_data (dso, sec->sec, sec->size);
+
+  /* The relocations point into the section data.  */
+  for (REL *rel = sec->relbuf; rel < sec->relend; rel++)
+    rel->ptr = (unsigned char *) data->d_buf + (rel->ptr - sec->data);
+  sec->relcur = sec->relbuf;
+
+  munmap (sec->map, sec->map_size);
+  sec->map = NULL;
+  sec->map_size = 0;
+  sec->map_released = NULL;
+  sec->data = data->d_buf;
+  sec->elf_data = data;
+}
+
+static int
+unit_contrib_cmp (const void *a, const void *b)
+{
+  const struct unit_contrib *ca = a, *cb = b;
+
+  if (ca->info_offs < cb->info_offs)
+    return -1;
+
+  if (ca->info_offs > cb->info_offs)
+    return 1;
+
+  return 0;
+}
+
+/* Parses the header of the DWARF5 unit index SEC (.debug_cu_index or
+   .debug_tu_index of a .dwp file).  Sets *NCOLSP and *NUNITSP and
+   returns a pointer to the section identifiers, followed by the
+   offsets and sizes tables.  Returns NULL after reporting when the
+   index cannot be handled.  */
+static unsigned char *
+read_unit_index_header (DSO *dso, struct debug_section *sec,
+			uint32_t *ncolsp, uint32_t *nunitsp)
+{
+  unsigned char *ptr = sec->data;
+  unsigned char *endsec = ptr + sec->size;
+
+  if (sec->size < 16)
+    {
+      error (0, 0, "%s: %s too small", dso->filename, sec->name);
+      return NULL;
+    }
+
+  /* version, padding, section count, unit count, slot count.  */
+  uint16_t version = read_16 (ptr);
+  ptr += 2;
+  if (version != 5)
+    {
+      error (0, 0, "%s: %s version %u unhandled", dso->filename,
+	     sec->name, version);
+      return NULL;
+    }
+  uint32_t ncols = read_32 (ptr);
+  uint32_t nunits = read_32 (ptr);
+  uint32_t nslots = read_32 (ptr);
+
+  /* Skip the hash table and the parallel table of indexes, we want
+     all units.  Then the section identifiers, offsets and sizes.  */
+  if ((uint64_t) nslots * (8 + 4) + (uint64_t) ncols * 4
+      + (uint64_t) nunits * ncols * 4 * 2 > (uint64_t) (endsec - ptr))
+    {
+      error (0, 0, "%s: %s too small", dso->filename, sec->name);
+      return NULL;
+    }
+
+  *ncolsp = ncols;
+  *nunitsp = nunits;
+  return ptr + (size_t) nslots * (8 + 4);
+}
+
+/* Adds the unit contributions of the unit index SEC to
+   dso->contribs.  Returns false when the index cannot be handled.  */
+static bool
+read_unit_index (DSO *dso, struct debug_section *sec)
+{
+  if (sec->data == NULL)
+    return true;
+
+  uint32_t ncols, nunits;
+  unsigned char *cols = read_unit_index_header (dso, sec, &ncols, &nunits);
+  if (cols == NULL)
+    return false;
+
+  struct unit_contrib *contribs;
+  contribs = realloc (dso->contribs, ((dso->ncontribs + nunits)
+				      * sizeof (struct unit_contrib)));
+  if (contribs == NULL)
+    error (1, errno, "%s: Could not allocate %s contributions",
+	   dso->filename, sec->name);
+  dso->contribs = contribs;
+
+  unsigned char *offs = cols + (size_t) ncols * 4;
+  for (uint32_t u = 0; u < nunits; u++)
+    {
+      struct unit_contrib *c = &dso->contribs[dso->ncontribs++];
+      memset (c, 0, sizeof (struct unit_contrib));
+      for (uint32_t col = 0; col < ncols; col++)
+	{
+	  uint32_t off = do_read_32 (offs + ((size_t) u * ncols + col) * 4);
+	  switch (do_read_32 (cols + (size_t) col * 4))
+	    {
+	    case DW_SECT_INFO:
+	      c->info_offs = off;
+	      break;
+	    case DW_SECT_ABBREV:
+	      c->abbrev_offs = off;
+	      break;
+	    case DW_SECT_LINE:
+	      c->line_offs = off;
+	      break;
+	    case DW_SECT_STR_OFFSETS:
+	      c->str_offsets_offs = off;
+	      break;
+	    case DW_SECT_MACRO:
+	      c->macro_offs = off;
+	      break;
+	    }
+	}
+    }
+
+  return true;
+}
+
+/* Returns the contributions of the .dwp unit at INFO_OFFS in
+   .debug_info.dwo, NULL when not a .dwp file.  */
+static const struct unit_contrib *
+find_unit_contrib (DSO *dso, size_t info_offs)
+{
+  if (dso->ncontribs == 0)
+    return NULL;
+
+  struct unit_contrib key;
+  key.info_offs = info_offs;
+  return bsearch (&key, dso->contribs, dso->ncontribs,
+		  sizeof (struct unit_contrib), unit_contrib_cmp);
+}
+
+/* edit_dwarf2_line moved and resized the line tables, update their
+   DW_SECT_LINE offsets and sizes in the unit index SEC.  */
+static void
+update_unit_index_lines (DSO *dso, struct debug_section *sec)
+{
+  if (sec->data == NULL)
+    return;
+
+  uint32_t ncols, nunits;
+  unsigned char *cols = read_unit_index_header (dso, sec, &ncols, &nunits);
+  assert (cols != NULL); /* Already checked by read_unit_index.  */
+  unsigned char *offs = cols + (size_t) ncols * 4;
+  unsigned char *sizes = offs + (size_t) nunits * ncols * 4;
+  for (uint32_t col = 0; col < ncols; col++)
+    if (do_read_32 (cols + (size_t) col * 4) == DW_SECT_LINE)
+      for (uint32_t u = 0; u < nunits; u++)
+	{
+	  size_t n = ((size_t) u * ncols + col) * 4;
+	  struct line_table *t = find_line_table (&dso->lines,
+						  do_read_32 (offs + n));
+	  if (t == NULL)
+	    continue;
+	  do_write_32 (offs + n, t->new_idx);
+	  do_write_32 (sizes + n, do_read_32 (sizes + n) + t->size_diff);
+	}
+  elf_flagdata (sec->elf_data, ELF_C_SET, ELF_F_DIRTY);
+  dirty_elf = 1;
+}
+
+static int
+edit_info (DSO *dso, int phase, struct debug_section *sec)
+{
+  unsigned char *ptr, *endcu, *endsec;
+  uint64_t value;
+  htab_t abbrev;
+  struct abbrev_tag tag, *t;
+  int i;
+  bool first;
+  struct CU *cu;
+
+  ptr = sec->data;
+  if (ptr == NULL)
+    return 0;
+
+  /* Before DWARF5 the type units are in (COMDAT) .debug_types
+     sections.  */
+  bool types_sec = strncmp (sec->name, ".debug_types",
+			    strlen (".debug_types")) == 0;
+
+  setup_relbuf(dso, sec);
+  endsec = ptr + sec->size;
+  while (ptr < endsec)
+    {
+      if (check_result != NULL && paths_changed ())
+	break;
+
+      cu = arena_alloc (&dso->arena, sizeof (struct CU));
+      if (cu == NULL)
+	error (1, errno, "%s: Could not allocate memory for next CU",
+	       dso->filename);
+
+      cu->next = dso->cus;
+      dso->cus = cu;
+
+      /* Everything else allocated while handling this CU (abbrevs,
+	 comp_dir, etc.) can go when done with it.  */
+      struct arena_mark cu_mark = arena_mark (&dso->arena);
+
+      unsigned char *cu_start = ptr;
+
+      /* header size, version, unit_type, ptr_size.  */
+      if (ptr + 4 + 2 + 1 + 1 > endsec)
+	{
+	  error (0, 0, "%s: %s CU header too small",
+		 dso->filename, sec->name);
+	  return 1;
+	}
+
+      int offset_size;
+      uint64_t unit_length = read_initial_length (ptr, offset_size);
+      if ((offset_size == 8 && ptr > endsec)
+	  || unit_length > (size_t) (endsec - ptr))
+	{
+	  error (0, 0, "%s: %s too small", dso->filename, sec->name);
+	  return 1;
+	}
+      endcu = ptr + unit_length;
+      cu->offset_size = offset_size;
+
+      int cu_version = read_16 (ptr);
+      if (cu_version != 2 && cu_version != 3 && cu_version != 4
+	  && cu_version != 5)
+	{
+	  error (0, 0, "%s: DWARF version %d unhandled", dso->filename,
+		 cu_version);
+	  return 1;
+	}
+      cu->cu_version = cu_version;
+
+      int cu_ptr_size = 0;
+
+      uint8_t unit_type = DW_UT_compile;
+      if (cu_version >= 5)
+	{
+	  unit_type = read_8 (ptr);
+	  if (unit_type != DW_UT_compile
+	      && unit_type != DW_UT_partial
+	      && unit_type != DW_UT_type
+	      && unit_type != DW_UT_skeleton
+	      && unit_type != DW_UT_split_compile
+	      && unit_type != DW_UT_split_type)
+	    {
+	      error (0, 0, "%s: Unit type %u unhandled", dso->filename,
+		     unit_type);
+	      return 1;
+	    }
+
+	  cu_ptr_size = read_8 (ptr);
+	}
+
+      bool type_unit = (unit_type == DW_UT_type
+			|| unit_type == DW_UT_split_type);
+      bool dwo_id = (unit_type == DW_UT_skeleton
+		     || unit_type == DW_UT_split_compile);
+      unsigned char *header_end = (cu_start + 23
+				   + (cu_version < 5
+				      ? 0
+				      : (type_unit
+					 ? 1 + 8 + 4 /* unit, id, off */
+					 : (dwo_id
+					    ? 1 + 8 /* unit, dwo_id */
+					    : 1)))  /* unit */
+				   /* 64-bit unit length, abbrev and type
+				      offsets.  */
+				   + (offset_size == 8 ? 8 + 4 + 4 : 0));
+      if (header_end > endsec)
+	{
+	  error (0, 0, "%s: %s CU header too small", dso->filename, sec->name);
+	  return 1;
+	}
+
+      /* Split units are in .dwo files.  All the units of a .dwp file
+	 share the sections, the unit index says where this unit's
+	 contributions to them start.  */
+      bool split_unit = (unit_type == DW_UT_split_compile
+			 || unit_type == DW_UT_split_type);
+      const struct unit_contrib *contrib = NULL;
+      if (split_unit)
+	contrib = find_unit_contrib (dso, cu_start - sec->data);
+
+      cu->split = split_unit;
+      cu->implicit_line = (split_unit
+			   && debug_sections[DEBUG_LINE].data != NULL);
+      cu->line_base = contrib != NULL ? contrib->line_offs : 0;
+      cu->macro_base = contrib != NULL ? contrib->macro_offs : 0;
+      cu->macros_offs = (size_t) -1;
+      /* Split units don't have a DW_AT_str_offsets_base, their
+	 strings start right after the header of their contribution.  */
+      cu->str_offsets_base = 0;
+      if (split_unit)
+	cu->str_offsets_base = ((contrib != NULL
+				 ? contrib->str_offsets_offs : 0)
+				+ INITIAL_LENGTH_SIZE (offset_size) + 2 + 2);
+
+      value = read_offset_relocated (ptr, sec, offset_size);
+      if (contrib != NULL)
+	value += contrib->abbrev_offs;
+      if (value >= debug_sections[DEBUG_ABBREV].size)
+	{
+	  if (debug_sections[DEBUG_ABBREV].data == NULL)
+	    error (0, 0, "%s: .debug_abbrev not present", dso->filename);
+	  else
+	    error (0, 0, "%s: DWARF CU abbrev offset too large",
+		   dso->filename);
+	  return 1;
+	}
+
+      if (cu_version < 5)
+	cu_ptr_size = read_8 (ptr);
+
+      if (cu_ptr_size != 4 && cu_ptr_size != 8)
+	{
+	  error (0, 0, "%s: Invalid DWARF pointer size %d",
+		 dso->filename, cu_ptr_size);
+	  return 1;
+	}
+
+      cu->ptr_size = cu_ptr_size;
+
+      if (types_sec || type_unit)
+	ptr += 8 + offset_size; /* Skip type_signature and type_offset.  */
+      else if (dwo_id)
+	ptr += 8;
+
+      abbrev = read_abbrev (dso,
+			    debug_sections[DEBUG_ABBREV].data + value);
+      if (abbrev == NULL)
+	return 1;
+      size_t abbrev_mark = cleanups_mark ();
+      push_cleanup (cleanup_htab_delete, abbrev, 0);
+
+      first = true;
+      while (ptr < endcu)
+	{
+	  tag.entry = read_uleb128 (ptr);
+	  if (tag.entry == 0)
+	    continue;
+	  t = htab_find_with_hash (abbrev, &tag, tag.entry);
+	  if (t == NULL)
+	    {
+	      error (0, 0, "%s: Could not find DWARF abbreviation %d",
+		     dso->filename, tag.entry);
+	      drop_cleanups (abbrev_mark);
+	      htab_delete (abbrev);
+	      return 1;
+	    }
+
+	  /* We need str_offsets_base before processing the CU. */
+	  if (first)
+	    {
+	      first = false;
+	      if (cu_version >= 5)
+		{
+		  uint32_t form;
+		  unsigned char *fptr = ptr;
+		  for (i = 0; i < t->nattr; ++i)
+		    {
+		      form = t->attr[i].form;
+		      if (t->attr[i].attr == DW_AT_str_offsets_base)
+			{
+			  cu->str_offsets_base
+			    = do_read_offset_relocated (fptr, sec,
+							offset_size);
+			  break;
+			}
+		      skip_form (dso, &form, &fptr, offset_size, cu);
+		    }
+		}
+	    }
+	  ptr = edit_attributes (dso, ptr, t, phase, sec, cu);
+	  if (ptr == NULL)
+	    break;
+	}
+
+      drop_cleanups (abbrev_mark);
+      htab_delete (abbrev);
+      arena_release (&dso->arena, cu_mark);
+
+      if (sec->map != NULL)
+	release_debug_section (sec, endcu);
+    }
+
+  return 0;
+}
+
+/* Rebuild .debug_str.  */
+static void
+edit_dwarf2_any_str (DSO *dso, struct strings *strings, debug_section *secp)
+{
+  Strtab *strtab = strings->str_tab;
+  Elf_Data *strdata = secp->elf_data;
+
+  /* A nicer way to do this would be to set the original d_size to
+     zero and add a new Elf_Data section to contain the new data.
+     Out with the old. In with the new.
+
+  int strndx = secp->sec;
+  Elf_Scn *strscn = dso->scn[strndx];
+  strdata->d_size = 0;
+  strdata = elf_newdata (strscn);
+
+    But when we then (recompress) the section there is a bug in
+    elfutils < 0.192 that causes the compression to fail/create bad
+    compressed data. So we just reuse the existing strdata (possibly
+    loosing track of the original d_buf, which will be overwritten).  */
+
+  /* We really should check whether we had enough memory,
+     but the old ebl version will just abort on out of
+     memory... */
+  strtab_finalize (strtab, strdata);
+  secp->size = strdata->d_size;
+  strings->str_buf = strdata->d_buf;
+  elf_flagdata (strdata, ELF_C_SET, ELF_F_DIRTY);
+
+  compact_strings (strings);
+}
+
+/* Records the strings of all .debug_str_offsets entries, used or not,
+   so update_str_offsets can rewrite every one of them.  Split DWARF
+   (.dwo) files have entries that nothing refers to, like the full
+   paths of the headers.  Those are handled as file names.  */
+static void
+record_str_offsets (DSO *dso)
+{
+  struct debug_section *str_off_sec = &debug_sections[DEBUG_STR_OFFSETS];
+  unsigned char *ptr = str_off_sec->data;
+  unsigned char *endp = ptr + str_off_sec->size;
+
+  setup_relbuf (dso, str_off_sec);
+  while (ptr < endp)
+    {
+      /* Read header, unit_length, version and padding.  */
+      if (endp - ptr < 3 * 4)
+	break;
+      int offset_size;
+      uint64_t unit_length = read_initial_length (ptr, offset_size);
+      if (ptr > endp || (size_t) (endp - ptr) < unit_length)
+	break;
+      unsigned char *endidxp = ptr + unit_length;
+      uint32_t version = read_16 (ptr);
+      if (version != 5)
+	break;
+      uint32_t padding = read_16 (ptr);
+      if (padding != 0)
+	break;
+
+      while (ptr < endidxp)
+	{
+	  size_t idx = read_offset_relocated (ptr, str_off_sec, offset_size);
+	  record_file_string_entry_idx (false, dso, idx);
+	}
+    }
+}
+
+/* Rebuild .debug_str_offsets.  The contributions of all units of a
+   .dwp file are rewritten serially, one after the other.  */
+static void
+update_str_offsets (DSO *dso)
+{
+  struct debug_section *str_off_sec = &debug_sections[DEBUG_STR_OFFSETS];
+  unsigned char *ptr = str_off_sec->data;
+  unsigned char *endp = ptr + str_off_sec->size;
+
+  while (ptr < endp)
+    {
+      /* Read header, unit_length, version and padding.  */
+      if (endp - ptr < 3 * 4)
+	break;
+      int offset_size;
+      uint64_t unit_length = read_initial_length (ptr, offset_size);
+      if (ptr > endp || (size_t) (endp - ptr) < unit_length)
+	break;
+      unsigned char *endidxp = ptr + unit_length;
+      uint32_t version = read_16 (ptr);
+      if (version != 5)
+	break;
+      uint32_t padding = read_16 (ptr);
+      if (padding != 0)
+	break;
+
+      while (ptr < endidxp)
+	{
+	  size_t idx, new_idx;
+	  idx = do_read_offset_relocated (ptr, str_off_sec, offset_size);
+	  new_idx = string_new_offset (&dso->debug_str, idx);
+	  write_offset_relocated (ptr, new_idx, offset_size);
+	}
+    }
+}
+
+static struct CU *
+find_macro_cu (DSO *dso, size_t macros_offs)
+{
+  struct CU *cu = dso->cus;
+  while (cu != NULL)
+    {
+      if (cu->macros_offs == macros_offs)
+	return cu;
+      cu = cu->next;
+    }
+
+  /* Not found, like the macro units imported by another one.  In a
+     .dwp file it belongs to the unit whose contribution it is in,
+     otherwise assume the first CU.  */
+  struct CU *found = NULL;
+  for (cu = dso->cus; cu != NULL; cu = cu->next)
+    if (cu->macro_base <= macros_offs
+	&& (found == NULL || cu->macro_base > found->macro_base))
+      found = cu;
+  return found != NULL ? found : dso->cus;
+}
+
+/* Whether the old path of any prefix map occurs in the sections that
+   paths are read from.  If not, nothing can be rewritten.  */
+static bool
+prefix_maps_mentioned (void)
+{
+  static const int path_sections[] = { DEBUG_INFO, DEBUG_TYPES, DEBUG_LINE,
+				       DEBUG_STR, DEBUG_LINE_STR };
+  for (size_t i = 0; i < cur_ctx->nprefix_maps; i++)
+    {
+      const char *old = cur_ctx->prefix_maps[i].old;
+      size_t old_len = strlen (old);
+      for (size_t j = 0; j < sizeof path_sections / sizeof (int); j++)
+	for (struct debug_section *sec = &debug_sections[path_sections[j]];
+	     sec != NULL; sec = sec->next)
+	  if (sec->data != NULL
+	      && memmem (sec->data, sec->size, old, old_len) != NULL)
+	    return true;
+    }
+  return false;
+}
+
+static int
+edit_dwarf2 (DSO *dso)
+{
+  Elf_Data *data;
+  Elf_Scn *scn;
+  int i, j;
+
+  for (i = 0; debug_sections[i].name; ++i)
+    {
+      debug_sections[i].data = NULL;
+      debug_sections[i].size = 0;
+      debug_sections[i].sec = 0;
+      debug_sections[i].relsec = 0;
+    }
+
+  for (i = 1; i < dso->ehdr.e_shnum; ++i)
+    if (! (dso->shdr[i].sh_flags & (SHF_ALLOC | SHF_WRITE | SHF_EXECINSTR))
+	&& dso->shdr[i].sh_size)
+      {
+        const char *name = strptr (dso, dso->ehdr.e_shstrndx,
+				   dso->shdr[i].sh_name);
+
+	if (name != NULL
+	    && strncmp (name, ".debug_", sizeof (".debug_") - 1) == 0)
+	  {
+	    for (j = 0; debug_sections[j].name; ++j)
+	      if (debug_section_name_eq (name, debug_sections[j].name))
+	 	{
+		  struct debug_section *debug_sec = &debug_sections[j];
+		  if (debug_sections[j].data)
+		    {
+		      if (j != DEBUG_MACRO && j != DEBUG_TYPES
+			  && j != DEBUG_INFO)
+			{
+			  error (0, 0, "%s: Found two copies of %s section",
+				 dso->filename, name);
+			  return 1;
+			}
+		      else
+			{
+			  /* In relocatable and .dwo files .debug_macro,
+			     .debug_types and (with DWARF5 type units)
+			     .debug_info might appear multiple times as
+			     COMDAT section.  */
+			  struct debug_section *sec;
+			  sec = calloc (sizeof (struct debug_section), 1);
+			  if (sec == NULL)
+			    error (1, errno,
+				   "%s: Could not allocate more %s sections",
+				   dso->filename, name);
+			  sec->name = name;
+
+			  struct debug_section *multi_sec = debug_sec;
+			  while (multi_sec->next != NULL)
+			    multi_sec = multi_sec->next;
+
+			  multi_sec->next = sec;
+			  debug_sec = sec;
+			}
+		    }
+
+		  scn = dso->scn[i];
+
+		  /* Scan the (big) DIE trees without reading them in
+		     completely if we should limit memory use.  */
+		  if (memory_limit != 0
+		      && (j == DEBUG_INFO || j == DEBUG_TYPES)
+		      && (dso->shdr[i].sh_flags & SHF_COMPRESSED) == 0
+		      && map_debug_section (dso, debug_sec, i))
+		    break;
+
+		  /* Check for compressed DWARF headers. Records
+		     ch_type so we can recompress headers after we
+		     processed the data.  */
+		  if (dso->shdr[i].sh_flags & SHF_COMPRESSED)
+		    {
+		      GElf_Chdr chdr;
+		      if (gelf_getchdr(dso->scn[i], &chdr) == NULL)
+			error (1, 0, "Couldn't get compressed header: %s",
+			       elf_errmsg (-1));
+		      debug_sec->ch_type = chdr.ch_type;
+		      if (elf_compress (scn, 0, 0) < 0)
+			error (1, 0, "Failed decompression");
+		      gelf_getshdr (scn, &dso->shdr[i]);
+		    }
+
+		  data = section_data (dso, i, dso->shdr[i].sh_size);
+		  debug_sec->data = data->d_buf;
+		  debug_sec->elf_data = data;
+		  debug_sec->size = data->d_size;
+		  debug_sec->sec = i;
+		  break;
+		}
+
+	    if (debug_sections[j].name == NULL)
+	      {
+		error (0, 0, "%s: Unknown debugging section %s",
+		       dso->filename, name);
+	      }
+	  }
+	else if (dso->ehdr.e_type == ET_REL
+		 && ((dso->shdr[i].sh_type == SHT_REL
+		      && name != NULL
+		      && strncmp (name, ".rel.debug_",
+				  sizeof (".rel.debug_") - 1) == 0)
+		     || (dso->shdr[i].sh_type == SHT_RELA
+			 && name != NULL
+			 && strncmp (name, ".rela.debug_",
+				     sizeof (".rela.debug_") - 1) == 0)))
+	  {
+	    for (j = 0; debug_sections[j].name; ++j)
+	      if (strcmp (name + sizeof (".rel") - 1
+			  + (dso->shdr[i].sh_type == SHT_RELA),
+			  debug_sections[j].name) == 0)
+	 	{
+		  if (j == DEBUG_MACRO || j == DEBUG_TYPES || j == DEBUG_INFO)
+		    {
+		      /* Pick the correct one.  */
+		      int rel_target = dso->shdr[i].sh_info;
+		      struct debug_section *multi_sec = &debug_sections[j];
+		      while (multi_sec != NULL)
+			{
+			  if (multi_sec->sec == rel_target)
+			    {
+			      multi_sec->relsec = i;
+			      break;
+			    }
+			  multi_sec = multi_sec->next;
+			}
+		      if (multi_sec == NULL)
+			error (0, 1, "No %s reloc section: %s",
+			       debug_sections[j].name, dso->filename);
+		    }
+		  else
+		    debug_sections[j].relsec = i;
+		  break;
+		}
+	  }
+      }
+
+  if (dso->ehdr.e_ident[EI_DATA] == ELFDATA2LSB)
+    {
+      do_read_16 = buf_read_ule16;
+      do_read_24 = buf_read_ule24;
+      do_read_32 = buf_read_ule32;
+      do_read_64 = buf_read_ule64;
+      do_write_16 = dwarf2_write_le16;
+      do_write_32 = dwarf2_write_le32;
+      do_write_64 = dwarf2_write_le64;
+    }
+  else if (dso->ehdr.e_ident[EI_DATA] == ELFDATA2MSB)
+    {
+      do_read_16 = buf_read_ube16;
+      do_read_24 = buf_read_ube24;
+      do_read_32 = buf_read_ube32;
+      do_read_64 = buf_read_ube64;
+      do_write_16 = dwarf2_write_be16;
+      do_write_32 = dwarf2_write_be32;
+      do_write_64 = dwarf2_write_be64;
+    }
+  else
+    {
+      error (0, 0, "%s: Wrong ELF data enconding", dso->filename);
+      return 1;
+    }
+
+  if (debug_sections[DEBUG_INFO].data == NULL)
+    return 0;
+
+  /* When only checking there is no need to walk the DIEs if none of
+     the paths to rewrite appear anywhere.  */
+  if (check_result != NULL && ! prefix_maps_mentioned ())
+    return 0;
+
+  /* A .dwp file combines the sections of many .dwo files, the unit
+     indexes say which part belongs to which unit.  */
+  if (! read_unit_index (dso, &debug_sections[DEBUG_CU_INDEX])
+      || ! read_unit_index (dso, &debug_sections[DEBUG_TU_INDEX]))
+    return 1;
+  if (dso->ncontribs != 0)
+    qsort (dso->contribs, dso->ncontribs, sizeof (struct unit_contrib),
+	   unit_contrib_cmp);
+
+  unsigned char *ptr, *endsec;
+  int phase;
+  for (phase = 0; phase < 2; phase++)
+    {
+      /* If we don't need to update anyhing, skip phase 1. */
+      if (phase == 1
+	  && !need_strp_update
+	  && !need_line_strp_update
+	  && !need_string_replacement
+	  && !need_stmt_update)
+	break;
+
+      /* Phase 1 edits the section data that libelf writes out.  */
+      if (phase == 1)
+	{
+	  for (struct debug_section *info_sec = &debug_sections[DEBUG_INFO];
+	       info_sec != NULL; info_sec = info_sec->next)
+	    if (info_sec->map != NULL)
+	      load_debug_section (dso, info_sec);
+	  for (struct debug_section *types_sec = &debug_sections[DEBUG_TYPES];
+	       types_sec != NULL; types_sec = types_sec->next)
+	    if (types_sec->map != NULL)
+	      load_debug_section (dso, types_sec);
+	}
+
+      struct debug_section *info_sec = &debug_sections[DEBUG_INFO];
+      while (info_sec != NULL)
+	{
+	  if (edit_info (dso, phase, info_sec))
+	    return 1;
+	  info_sec = info_sec->next;
+	}
+
+      struct debug_section *types_sec = &debug_sections[DEBUG_TYPES];
+      while (types_sec != NULL)
+	{
+	  if (edit_info (dso, phase, types_sec))
+	    return 1;
+	  types_sec = types_sec->next;
+	}
+
+      /* Checking is done once any path is known to change.  */
+      if (check_result != NULL && paths_changed ())
+	return 0;
+
+      /* We might have to recalculate/rewrite the debug_line
+	 section.  We need to do that before going into phase one
+	 so we have all new offsets.  We do this separately from
+	 scanning the dirs/file names because the DW_AT_stmt_lists
+	 might not be in order or skip some padding we might have
+	 to (re)move. */
+      if (phase == 0 && need_stmt_update)
+	{
+	  edit_dwarf2_line (dso);
+
+	  update_line_relocs (dso);
+	  update_unit_index_lines (dso, &debug_sections[DEBUG_CU_INDEX]);
+	  update_unit_index_lines (dso, &debug_sections[DEBUG_TU_INDEX]);
+	}
+
+      /* The .debug_macro section also contains offsets into the
+	 .debug_str section and references to the .debug_line
+	 tables, so we need to update those as well if we update
+	 the strings or the stmts.  */
+      if ((need_strp_update || need_stmt_update)
+	  && debug_sections[DEBUG_MACRO].data)
+	{
+	  /* There might be multiple (COMDAT) .debug_macro sections.  */
+	  struct debug_section *macro_sec = &debug_sections[DEBUG_MACRO];
+	  while (macro_sec != NULL)
+	    {
+	      setup_relbuf(dso, macro_sec);
+
+	      ptr = macro_sec->data;
+	      endsec = ptr + macro_sec->size;
+	      int op = 0, macro_version, macro_flags;
+	      int offset_len = 4, line_offset = 0;
+	      struct CU *cu = NULL;
+
+	      while (ptr < endsec)
+		{
+		  if (!op)
+		    {
+		      cu = find_macro_cu (dso, ptr - macro_sec->data);
+		      macro_version = read_16 (ptr);
+		      macro_flags = read_8 (ptr);
+		      if (macro_version < 4 || macro_version > 5)
+			error (1, 0, "unhandled .debug_macro version: %d",
+			       macro_version);
+		      if ((macro_flags & ~3) != 0)
+			error (1, 0, "unhandled .debug_macro flags: 0x%x",
+			       macro_flags);
+
+		      offset_len = (macro_flags & 0x01) ? 8 : 4;
+		      line_offset = (macro_flags & 0x02) ? 1 : 0;
+
+		      /* Update the line_offset if it is there.  Split
+			 units keep their line table at the start of their
+			 contribution, their offset doesn't change.  */
+		      if (line_offset)
+			{
+			  if (phase == 0 || (cu != NULL && cu->split))
+			    ptr += offset_len;
+			  else
+			    {
+			      size_t idx, new_idx;
+			      idx = do_read_offset_relocated (ptr, macro_sec,
+							       offset_len);
+			      new_idx = find_new_list_offs (&dso->lines,
+							    idx);
+			      write_offset_relocated (ptr, new_idx,
+						      offset_len);
+			    }
+			}
+		    }
+
+		  op = read_8 (ptr);
+		  if (!op)
+		    continue;
+		  switch(op)
+		    {
+		    case DW_MACRO_GNU_define:
+		    case DW_MACRO_GNU_undef:
+		      read_uleb128 (ptr);
+		      ptr = ((unsigned char *) strchr ((char *) ptr, '\0')
+			     + 1);
+		      break;
+		    case DW_MACRO_GNU_start_file:
+		      read_uleb128 (ptr);
+		      read_uleb128 (ptr);
+		      break;
+		    case DW_MACRO_GNU_end_file:
+		      break;
+		    case DW_MACRO_GNU_define_indirect:
+		    case DW_MACRO_GNU_undef_indirect:
+		      read_uleb128 (ptr);
+		      if (phase == 0)
+			{
+			  size_t idx = read_offset_relocated (ptr, macro_sec,
+							      offset_len);
+			  record_existing_string_entry_idx (false, dso, idx);
+			}
+		      else if (need_strp_update)
+			{
+			  size_t idx, new_idx;
+			  idx = do_read_offset_relocated (ptr, macro_sec,
+							  offset_len);
+			  new_idx = string_new_offset (&dso->debug_str, idx);
+			  write_offset_relocated (ptr, new_idx, offset_len);
+			}
+		      else
+			ptr += offset_len;
+		      break;
+		    case DW_MACRO_GNU_transparent_include:
+		      ptr += offset_len;
+		      break;
+		    case DW_MACRO_define_strx:
+		    case DW_MACRO_undef_strx:
+		      read_uleb128 (ptr);
+		      if (phase == 0)
+			{
+			  size_t idx;
+			  idx = do_read_str_form_relocated (dso, DW_FORM_strx,
+							    ptr, macro_sec,
+							    offset_len, cu);
+			  record_existing_string_entry_idx (false, dso, idx);
+			}
+		      read_uleb128 (ptr);
+		      break;
+		    default:
+		      error (1, 0, "Unhandled DW_MACRO op 0x%x", op);
+		      break;
+		    }
+		}
+
+	      macro_sec = macro_sec->next;
+	    }
+	}
+
+
+      /* Now handle all the DWARF5 line tables, they contain strp
+	 and/or line_strp entries that need to be registered/rewritten.  */
+      setup_relbuf(dso, &debug_sections[DEBUG_LINE]);
+
+      /* edit_dwarf2_line will have set this up, unless there are no
+	 moved/resized (DWARF4) lines. In which case we can just use
+	 the original section data. new_idx will have been setup
+	 correctly, even if it is the same as old_idx.  */
+      unsigned char *line_buf = (unsigned char *)dso->lines.line_buf;
+      if (line_buf == NULL)
+	line_buf = debug_sections[DEBUG_LINE].data;
+      for (int ldx = 0; ldx < dso->lines.used; ldx++)
+	{
+	  struct line_table *t = &dso->lines.table[ldx];
+	  if (t->version >= 5)
+	    read_dwarf5_line (dso, line_buf + t->new_idx, t, phase);
+	}
+
+      /* Those were the last paths to look at for checking.  */
+      if (check_result != NULL)
+	return 0;
+
+      /* Same for the debug_str and debug_line_str sections.
+	 Make sure everything is in place for phase 1 updating of debug_info
+	 references. */
+      if (phase == 0 && need_strp_update)
+	{
+	  record_str_offsets (dso);
+	  edit_dwarf2_any_str (dso, &dso->debug_str,
+			       &debug_sections[DEBUG_STR]);
+	}
+      if (phase == 0 && need_line_strp_update)
+	edit_dwarf2_any_str (dso, &dso->debug_line_str,
+			     &debug_sections[DEBUG_LINE_STR]);
+    }
+
+  /* After phase 1 we might have rewritten the debug_info with
+     new strp, strings and/or linep offsets.  */
+  if (need_strp_update || need_line_strp_update
+      || need_string_replacement || need_stmt_update) {
+    dirty_section (DEBUG_INFO);
+    if (debug_sections[DEBUG_TYPES].data != NULL)
+      dirty_section (DEBUG_TYPES);
+  }
+  if (need_strp_update || need_stmt_update)
+    dirty_section (DEBUG_MACRO);
+  if (need_stmt_update || need_line_strp_update)
+    dirty_section (DEBUG_LINE);
+  if (need_strp_update && debug_sections[DEBUG_STR_OFFSETS].data != NULL)
+    {
+      setup_relbuf(dso, &debug_sections[DEBUG_STR_OFFSETS]);
+      update_str_offsets (dso);
+      dirty_section (DEBUG_STR_OFFSETS);
+      update_rela_data (dso, &debug_sections[DEBUG_STR_OFFSETS]);
+    }
+
+  /* Update any relocations addends we might have touched. */
+  struct debug_section *info_sec = &debug_sections[DEBUG_INFO];
+  while (info_sec != NULL)
+    {
+      update_rela_data (dso, info_sec);
+      info_sec = info_sec->next;
+    }
+
+  struct debug_section *types_sec = &debug_sections[DEBUG_TYPES];
+  while (types_sec != NULL)
+    {
+      update_rela_data (dso, types_sec);
+      types_sec = types_sec->next;
+    }
+
+  struct debug_section *macro_sec = &debug_sections[DEBUG_MACRO];
+  while (macro_sec != NULL)
+    {
+      update_rela_data (dso, macro_sec);
+      macro_sec = macro_sec->next;
+    }
+
+  update_rela_data (dso, &debug_sections[DEBUG_LINE]);
+
+  return 0;
+}
+
+/* Returns the debug_section for ELF section number SEC, or NULL if
+   edit_dwarf2 didn't pick up that section.  */
+static struct debug_section *
+find_debug_section (int sec)
+{
+  for (int s = 0; debug_sections[s].name; s++)
+    for (struct debug_section *secp = &debug_sections[s]; secp != NULL;
+	 secp = secp->next)
+      if (secp->data != NULL && secp->sec == sec)
+	return secp;
+  return NULL;
+}
+
+/* Returns the compression type a debug section that had compression
+   type IN_TYPE (zero if uncompressed) in the input file should be
+   written out with.  */
+static uint32_t
+output_compression (uint32_t in_type)
+{
+  if (compress_type == -1)
+    return in_type;
+
+  if (in_type == 0 && ! compress_all)
+    return 0;
+
+  return compress_type;
+}
+
+/* Whether libelf elf_compress can compress with the given type.  */
+static bool
+libelf_can_compress (uint32_t type)
+{
+  if (type == ELFCOMPRESS_ZLIB)
+    return true;
+#if _ELFUTILS_PREREQ (0, 189)
+  if (type == ELFCOMPRESS_ZSTD)
+    return true;
+#endif
+  return false;
+}
+
+/* Whether to use libelf elf_compress to compress with the given
+   type.  We compress ourselves when a specific compression level is
+   requested.  And for zstd with more than one job when we have
+   libzstd, so big sections are compressed by multiple threads.  */
+static bool
+use_libelf_compress (uint32_t type)
+{
+  if (compress_level != -1 || ! libelf_can_compress (type))
+    return false;
+#ifdef HAVE_ZSTD
+  if (type == ELFCOMPRESS_ZSTD && jobs > 1)
+    return false;
+#endif
+  return true;
+}
+
+#ifdef HAVE_ZSTD
+/* The size of the chunks zstd multithreaded compression hands to its
+   workers.  The zstd default is a multiple of the window size, which
+   is bigger than most sections, so those would be one chunk for one
+   worker.  */
+#define ZSTD_JOB_SIZE (1024 * 1024)
+
+/* Makes CCTX compress with jobs threads if there is more than one.
+   With workers zstd produces the same output for any number of them,
+   but not the same as without, so -j1 compresses in this thread like
+   elf_compress does.  When libzstd was built without multithread
+   support it always compresses in this thread.  */
+static void
+zstd_set_workers (ZSTD_CCtx *cctx)
+{
+  if (jobs > 1
+      && ! ZSTD_isError (ZSTD_CCtx_setParameter (cctx, ZSTD_c_nbWorkers,
+						 jobs)))
+    (void) ZSTD_CCtx_setParameter (cctx, ZSTD_c_jobSize, ZSTD_JOB_SIZE);
+}
+#endif
+
+/* Whether we can compress with the given type at compress_level.  */
+static bool
+can_compress (uint32_t type)
+{
+  if (type == ELFCOMPRESS_ZLIB)
+    return true;
+#ifdef HAVE_ZSTD
+  if (type == ELFCOMPRESS_ZSTD)
+    return true;
+#endif
+  return use_libelf_compress (type);
+}
+
+/* Returns the maximum size compress_buf might need to compress
+   SIZE bytes with TYPE.  */
+static size_t
+compress_bound (uint32_t type, size_t size)
+{
+#ifdef HAVE_ZSTD
+  if (type == ELFCOMPRESS_ZSTD)
+    return ZSTD_compressBound (size);
+#endif
+  return compressBound (size);
+}
+
+/* Compresses the (uncompressed) data BUF of SIZE bytes with TYPE
+   into OUT, which has room for compress_bound bytes.  Returns the
+   compressed size.  */
+static size_t
+compress_buf (DSO *dso, uint32_t type, const void *buf, size_t size,
+	      void *out, size_t out_size)
+{
+  if (type == ELFCOMPRESS_ZLIB)
+    {
+      uLongf dest_len = out_size;
+      int level = (compress_level == -1
+		   ? Z_DEFAULT_COMPRESSION : compress_level);
+      int res = compress2 (out, &dest_len, buf, size, level);
+      if (res != Z_OK)
+	error (1, 0, "%s: zlib compression failed: %s",
+	       dso->filename, zError (res));
+      return dest_len;
+    }
+#ifdef HAVE_ZSTD
+  if (type == ELFCOMPRESS_ZSTD)
+    {
+      int level = (compress_level == -1
+		   ? ZSTD_CLEVEL_DEFAULT : compress_level);
+      ZSTD_CCtx *cctx = ZSTD_createCCtx ();
+      if (cctx == NULL)
+	error (1, ENOMEM, "%s: Couldn't create zstd context", dso->filename);
+      size_t res = ZSTD_CCtx_setParameter (cctx, ZSTD_c_compressionLevel,
+					   level);
+      /* The result is still one standard zstd frame.  */
+      if (! ZSTD_isError (res))
+	zstd_set_workers (cctx);
+      if (! ZSTD_isError (res))
+	res = ZSTD_compress2 (cctx, out, out_size, buf, size);
+      ZSTD_freeCCtx (cctx);
+      if (ZSTD_isError (res))
+	error (1, 0, "%s: zstd compression failed: %s",
+	       dso->filename, ZSTD_getErrorName (res));
+      return res;
+    }
+#endif
+  error (1, 0, "%s: Unsupported compression type %u", dso->filename, type);
+  return 0;
+}
+
+/* Compress section SEC with TYPE.  Uses libelf if use_libelf_compress
+   says so.  Otherwise compresses the section data itself and replaces the
+   section data with the (file format) compression header followed by
+   the compressed data.  Just like elf_compress the section is left
+   uncompressed when compression doesn't make it smaller.  */
+static void
+compress_debug_section (DSO *dso, int sec, uint32_t type)
+{
+  Elf_Scn *scn = dso->scn[sec];
+
+  if (use_libelf_compress (type))
+    {
+      if (elf_compress (scn, type, 0) < 0)
+	error (1, 0, "Failed recompression");
+      return;
+    }
+
+  GElf_Shdr shdr;
+  if (gelf_getshdr (scn, &shdr) == NULL)
+    error (1, 0, "Couldn't get shdr: %s", elf_errmsg (-1));
+
+  Elf_Data *data = elf_getdata (scn, NULL);
+  if (data == NULL)
+    error (1, 0, "Couldn't get section data: %s", elf_errmsg (-1));
+  if (elf_getdata (scn, data) != NULL)
+    error (1, 0, "%s: Unexpected section data", dso->filename);
+
+  size_t chdr_size = gelf_fsize (dso->elf, ELF_T_CHDR, 1, EV_CURRENT);
+  size_t chdr_align = gelf_getclass (dso->elf) == ELFCLASS32 ? 4 : 8;
+  size_t size = data->d_size;
+  if (size <= chdr_size)
+    return;
+
+  size_t bound = compress_bound (type, size);
+  unsigned char *buf = malloc (chdr_size + bound);
+  if (buf == NULL)
+    error (1, ENOMEM, "%s: Couldn't allocate compressed %zd bytes section",
+	   dso->filename, size);
+  size_t mark = cleanups_mark ();
+  push_cleanup (cleanup_free, buf, 0);
+
+  size_t csize = compress_buf (dso, type, data->d_buf, size,
+			       buf + chdr_size, bound);
+  if (chdr_size + csize >= size)
+    {
+      drop_cleanups (mark);
+      free (buf);
+      return;
+    }
+
+  GElf_Chdr chdr;
+  memset (&chdr, 0, sizeof chdr);
+  chdr.ch_type = type;
+  chdr.ch_size = size;
+  chdr.ch_addralign = shdr.sh_addralign ?: 1;
+  Elf_Data src = { .d_buf = &chdr, .d_type = ELF_T_CHDR,
+		   .d_version = EV_CURRENT };
+  Elf_Data dst = { .d_buf = buf, .d_type = ELF_T_CHDR,
+		   .d_version = EV_CURRENT, .d_size = chdr_size };
+  if (gelf_getclass (dso->elf) == ELFCLASS32)
+    {
+      Elf32_Chdr chdr32 = { .ch_type = chdr.ch_type,
+			    .ch_size = chdr.ch_size,
+			    .ch_addralign = chdr.ch_addralign };
+      src.d_buf = &chdr32;
+      src.d_size = sizeof chdr32;
+      if (elf32_xlatetof (&dst, &src, dso->ehdr.e_ident[EI_DATA]) == NULL)
+	error (1, 0, "Couldn't convert chdr: %s", elf_errmsg (-1));
+    }
+  else
+    {
+      src.d_size = sizeof chdr;
+      if (elf64_xlatetof (&dst, &src, dso->ehdr.e_ident[EI_DATA]) == NULL)
+	error (1, 0, "Couldn't convert chdr: %s", elf_errmsg (-1));
+    }
+
+  if (dso->scn_bufs == NULL)
+    {
+      dso->scn_bufs = calloc (dso->ehdr.e_shnum, sizeof (void *));
+      if (dso->scn_bufs == NULL)
+	error (1, ENOMEM, "%s: Couldn't allocate section buffers",
+	       dso->filename);
+    }
+  free (dso->scn_bufs[sec]);
+  dso->scn_bufs[sec] = buf;
+  drop_cleanups (mark);
+
+  data->d_buf = buf;
+  data->d_size = chdr_size + csize;
+  data->d_type = ELF_T_BYTE;
+  data->d_align = chdr_align;
+  elf_flagdata (data, ELF_C_SET, ELF_F_DIRTY);
+
+  shdr.sh_flags |= SHF_COMPRESSED;
+  shdr.sh_size = data->d_size;
+  shdr.sh_addralign = chdr_align;
+  if (gelf_update_shdr (scn, &shdr) == 0)
+    error (1, 0, "Couldn't update shdr: %s", elf_errmsg (-1));
+}
+
+/* Whether the compression of any debug section needs to change, the
+   ELF file needs to be written out if so.  */
+static bool
+compression_changes (DSO *dso)
+{
+  for (int i = 1; i < dso->ehdr.e_shnum; i++)
+    {
+      const char *name;
+      if ((dso->shdr[i].sh_flags & SHF_ALLOC) != 0
+	  || dso->shdr[i].sh_type == SHT_NOBITS
+	  || dso->shdr[i].sh_size == 0
+	  || (name = strptr (dso, dso->ehdr.e_shstrndx,
+			     dso->shdr[i].sh_name)) == NULL
+	  || strncmp (name, ".debug_", sizeof (".debug_") - 1) != 0)
+	continue;
+
+      uint32_t in_type = 0;
+      struct debug_section *secp = find_debug_section (i);
+      if (secp != NULL)
+	in_type = secp->ch_type;
+      else if (dso->shdr[i].sh_flags & SHF_COMPRESSED)
+	{
+	  GElf_Chdr chdr;
+	  if (gelf_getchdr (dso->scn[i], &chdr) == NULL)
+	    error (1, 0, "Couldn't get compressed header: %s",
+		   elf_errmsg (-1));
+	  in_type = chdr.ch_type;
+	}
+
+      if (output_compression (in_type) != in_type)
+	return true;
+    }
+  return false;
+}
+
+/* Recompress any debug sections that might have been uncompressed by
+   edit_dwarf2 and change the compression of debug sections as
+   requested by compress_type and compress_all.  Sets recompressed
+   when the ELF file needs to be written out again.  */
+static void
+recompress_debug_sections (DSO *dso)
+{
+  /* Nothing changed and nothing will be written, edit_dwarf2 might
+     have uncompressed some sections, but that doesn't matter.  */
+  if (! dirty_elf && ! compression_changes (dso))
+    return;
+
+  for (int i = 1; i < dso->ehdr.e_shnum; i++)
+    {
+      const char *name;
+      if ((dso->shdr[i].sh_flags & SHF_ALLOC) != 0
+	  || dso->shdr[i].sh_type == SHT_NOBITS
+	  || dso->shdr[i].sh_size == 0
+	  || (name = strptr (dso, dso->ehdr.e_shstrndx,
+			     dso->shdr[i].sh_name)) == NULL
+	  || strncmp (name, ".debug_", sizeof (".debug_") - 1) != 0)
+	continue;
+
+      /* Sections picked up by edit_dwarf2 have been uncompressed.  */
+      uint32_t in_type = 0, cur_type = 0;
+      Elf_Scn *scn = dso->scn[i];
+      struct debug_section *secp = find_debug_section (i);
+      if (secp != NULL)
+	in_type = secp->ch_type;
+      else if (dso->shdr[i].sh_flags & SHF_COMPRESSED)
+	{
+	  GElf_Chdr chdr;
+	  if (gelf_getchdr (scn, &chdr) == NULL)
+	    error (1, 0, "Couldn't get compressed header: %s",
+		   elf_errmsg (-1));
+	  in_type = cur_type = chdr.ch_type;
+	}
+
+      uint32_t out_type = output_compression (in_type);
+      if (out_type == cur_type && out_type == in_type)
+	continue;
+
+      if (out_type != 0 && ! can_compress (out_type))
+	error (1, 0, "%s: Cannot compress %s with compression type %u",
+	       dso->filename, name, out_type);
+
+      if (cur_type != 0 && elf_compress (scn, 0, 0) < 0)
+	error (1, 0, "Failed decompression");
+      if (out_type != 0)
+	compress_debug_section (dso, i, out_type);
+
+      gelf_getshdr (scn, &dso->shdr[i]);
+      Elf_Data *data = elf_getdata (scn, NULL);
+      if (secp != NULL)
+	{
+	  secp->elf_data = data;
+	  secp->data = data->d_buf;
+	  secp->size = data->d_size;
+	}
+      elf_flagshdr (scn, ELF_C_SET, ELF_F_DIRTY);
+      elf_flagdata (data, ELF_C_SET, ELF_F_DIRTY);
+      recompressed = true;
+    }
+}
+
+static DSO *
+fdopen_dso (int fd, const char *name)
+{
+  Elf *elf = NULL;
+  GElf_Ehdr ehdr;
+  int i;
+  DSO *dso = NULL;
+  size_t phnum;
+
+  if (build_id_only)
+    elf = elf_begin (fd, ELF_C_READ_MMAP_PRIVATE, NULL);
+  else if (check_result != NULL
+	   || (prefix_maps == NULL && (!do_build_id || no_recompute_build_id)
+	       && compress_type == -1))
+    elf = elf_begin (fd, ELF_C_READ, NULL);
+  else
+    elf = elf_begin (fd, ELF_C_RDWR, NULL);
+  if (elf == NULL)
+    error (1, 0, "cannot open ELF file: %s", elf_errmsg (-1));
+  cur_ctx->elf = elf;
+
+  if (elf_kind (elf) != ELF_K_ELF)
+    error (1, 0, "\"%s\" is not an ELF file", name);
+
+  if (gelf_getehdr (elf, &ehdr) == NULL)
+    error (1, 0, "cannot get the ELF header: %s", elf_errmsg (-1));
+
+  if (ehdr.e_type != ET_DYN && ehdr.e_type != ET_EXEC && ehdr.e_type != ET_REL)
+    error (1, 0, "\"%s\" is not a shared library", name);
+
+  if (elf_getphdrnum (elf, &phnum) != 0)
+    error (1, 0, "Couldn't get number of phdrs: %s", elf_errmsg (-1));
+
+  /* Allocate DSO structure. Leave place for additional 20 new section
+     headers.  */
+  dso = (DSO *)
+	malloc (sizeof(DSO) + (ehdr.e_shnum + 20) * sizeof(GElf_Shdr)
+	        + (ehdr.e_shnum + 20) * sizeof(Elf_Scn *));
+  if (!dso)
+    error (1, ENOMEM, "Could not open DSO");
+
+  /* If there are phdrs we want to maintain the layout of the
+     allocated sections in the file.  */
+  if (phnum != 0)
+    elf_flagelf (elf, ELF_C_SET, ELF_F_LAYOUT);
+
+  memset (dso, 0, sizeof(DSO));
+  dso->elf = elf;
+  dso->fd = fd;
+  dso->phnum = phnum;
+  dso->ehdr = ehdr;
+  dso->scn = (Elf_Scn **) &dso->shdr[ehdr.e_shnum + 20];
+  /* From now on the Elf is freed together with the DSO.  */
+  cur_ctx->elf = NULL;
+  cur_ctx->dso = dso;
+
+  for (i = 0; i < ehdr.e_shnum; ++i)
+    {
+      dso->scn[i] = elf_getscn (elf, i);
+      gelf_getshdr (dso->scn[i], dso->shdr + i);
+    }
+
+  dso->filename = (const char *) strdup (name);
+  if (dso->filename == NULL)
+    error (1, ENOMEM, "Could not open DSO");
+  setup_strings (&dso->debug_str);
+  setup_strings (&dso->debug_line_str);
+  setup_lines (&dso->lines);
+  return dso;
+}
+
+/* Look for a GNU build-ID note in the allocated SHT_NOTE sections.
+   Returns the section number it was found in, zero if not found.  */
+static int
+find_build_id (DSO *dso, Elf_Data **build_id,
+	       size_t *build_id_offset, size_t *build_id_size)
+{
+  for (int i = 1; i < dso->ehdr.e_shnum; i++)
+    if (dso->shdr[i].sh_type == SHT_NOTE
+	&& (dso->shdr[i].sh_flags & SHF_ALLOC))
+      {
+	size_t off = 0;
+	GElf_Nhdr nhdr;
+	size_t name_off;
+	size_t desc_off;
+	Elf_Data *data = elf_getdata (elf_getscn (dso->elf, i), NULL);
+	while ((off = gelf_getnote (data, off,
+				    &nhdr, &name_off, &desc_off)) > 0)
+	  if (nhdr.n_type == NT_GNU_BUILD_ID
+	      && nhdr.n_namesz == sizeof "GNU"
+	      && (memcmp ((char *)data->d_buf + name_off, "GNU",
+			  sizeof "GNU") == 0))
+	    {
+	      *build_id = data;
+	      *build_id_offset = desc_off;
+	      *build_id_size = nhdr.n_descsz;
+	    }
+	if (*build_id != NULL)
+	  return i;
+      }
+
+  return 0;
+}
+
+/* Start the build-id hash state, primed with the seed (if any) and
+   fed with the relevant header bits.  The only bits we ignore are the
+   offset fields in ehdr and shdrs, since the semantically identical
+   ELF file could be written differently if it doesn't change the phdr
+   layout.  We always use the GElf (i.e. Elf64) formats for the bits
+   to hash since it is convenient.  It doesn't matter whether this is
+   an Elf32 or Elf64 object, only that we are consistent in what bits
+   feed the hash so it comes out the same for the same file
+   contents.  */
+static XXH3_state_t *
+build_id_hash_start (DSO *dso)
+{
+  XXH3_state_t* state = XXH3_createState();
+  if (!state)
+    error (1, errno, "Failed to create xxhash state");
+  XXH3_128bits_reset (state);
+
+  /* If a seed string was given use it to prime the hash.  */
+  if (build_id_seed != NULL)
+    /* Another choice is XXH3_generateSecret. */
+    XXH3_128bits_update (state, build_id_seed, strlen (build_id_seed));
+
+  union
+  {
+    GElf_Ehdr ehdr;
+    GElf_Phdr phdr;
+  } u;
+  Elf_Data x = { .d_version = EV_CURRENT, .d_buf = &u };
+
+  x.d_type = ELF_T_EHDR;
+  x.d_size = sizeof u.ehdr;
+  u.ehdr = dso->ehdr;
+  u.ehdr.e_phoff = u.ehdr.e_shoff = 0;
+  if (elf64_xlatetom (&x, &x, dso->ehdr.e_ident[EI_DATA]) == NULL)
+    {
+    bad:
+      error (1, 0, "Failed to compute header checksum: %s",
+	     elf_errmsg (elf_errno ()));
+    }
+
+  x.d_type = ELF_T_PHDR;
+  x.d_size = sizeof u.phdr;
+  for (int i = 0; i < dso->ehdr.e_phnum; ++i)
+    {
+      if (gelf_getphdr (dso->elf, i, &u.phdr) == NULL)
+	goto bad;
+      if (elf64_xlatetom (&x, &x, dso->ehdr.e_ident[EI_DATA]) == NULL)
+	goto bad;
+
+      XXH3_128bits_update (state, x.d_buf, x.d_size);
+    }
+
+  return state;
+}
+
+/* Put the section header of section SEC as it is fed into the
+   build-id hash in SHDR.  */
+static void
+build_id_hash_shdr (DSO *dso, int sec, GElf_Shdr *shdr)
+{
+  Elf_Data x = { .d_version = EV_CURRENT, .d_buf = shdr,
+		 .d_type = ELF_T_SHDR, .d_size = sizeof *shdr };
+  *shdr = dso->shdr[sec];
+  shdr->sh_offset = 0;
+  if (elf64_xlatetom (&x, &x, dso->ehdr.e_ident[EI_DATA]) == NULL)
+    error (1, 0, "Failed to compute header checksum: %s",
+	   elf_errmsg (elf_errno ()));
+}
+
+/* Everything before the first (relocation section for a) .debug
+   section is never changed by debugedit, except for the build-id bits
+   themselves.  So those sections can be fed into the build-id hash
+   while the DWARF data is being edited.  The background thread reads
+   the section contents from a mapping of the file, which is only
+   identical to what libelf hands us when the file has the host byte
+   order.  handle_build_id continues where the thread stopped.  */
+struct build_id_hash
+{
+  pthread_t thread;
+  XXH3_state_t *state;
+  const unsigned char *map;
+  size_t map_size;
+  /* Sections [0, nscns) are hashed by the thread, using the shdrs
+     already prepared for hashing and the original sh_offsets.  */
+  int nscns;
+  GElf_Shdr *shdrs;
+  GElf_Off *offsets;
+  /* The build-id bits (in section note_scn) are hashed as zeros.  */
+  int note_scn;
+  size_t note_off, note_size;
+};
+
+static void *
+build_id_hash_thread (void *arg)
+{
+  struct build_id_hash *bh = arg;
+  static const unsigned char zeros[sizeof (XXH128_canonical_t)];
+
+  for (int i = 0; i < bh->nscns; ++i)
+    {
+      const GElf_Shdr *shdr = &bh->shdrs[i];
+      XXH3_128bits_update (bh->state, shdr, sizeof *shdr);
+      if (shdr->sh_type == SHT_NOBITS)
+	continue;
+
+      const unsigned char *d = bh->map + bh->offsets[i];
+      size_t size = shdr->sh_size;
+      if (i == bh->note_scn)
+	{
+	  size_t zsize = MIN (bh->note_size, sizeof zeros);
+	  XXH3_128bits_update (bh->state, d, bh->note_off);
+	  XXH3_128bits_update (bh->state, zeros, zsize);
+	  d += bh->note_off + zsize;
+	  size -= bh->note_off + zsize;
+	}
+      XXH3_128bits_update (bh->state, d, size);
+    }
+
+  return NULL;
+}
+
+static bool
+is_debug_section_name (const char *name)
+{
+  return (strncmp (name, ".debug_", strlen (".debug_")) == 0
+	  || strncmp (name, ".rel.debug_", strlen (".rel.debug_")) == 0
+	  || strncmp (name, ".rela.debug_", strlen (".rela.debug_")) == 0);
+}
+
+/* Start hashing the unchanged sections of DSO (opened from FD) in the
+   background.  The build-id note desc bits are at NOTE_OFF in section
+   NOTE_SCN and NOTE_SIZE bytes long.  Silently does nothing if that
+   isn't possible, handle_build_id will then hash everything.  */
+static void
+start_build_id_hash (DSO *dso, int fd, int note_scn,
+		     size_t note_off, size_t note_size)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+  if (dso->ehdr.e_ident[EI_DATA] != ELFDATA2LSB)
+    return;
+#else
+  if (dso->ehdr.e_ident[EI_DATA] != ELFDATA2MSB)
+    return;
+#endif
+
+  struct stat st;
+  if (fstat (fd, &st) != 0 || st.st_size <= 0)
+    return;
+  size_t map_size = st.st_size;
+
+  int n;
+  for (n = 0; n < dso->ehdr.e_shnum; ++n)
+    {
+      const GElf_Shdr *shdr = &dso->shdr[n];
+      if ((shdr->sh_flags & SHF_ALLOC) == 0)
+	{
+	  const char *name = strptr (dso, dso->ehdr.e_shstrndx,
+				     shdr->sh_name);
+	  if (name == NULL || is_debug_section_name (name))
+	    break;
+	}
+      if (shdr->sh_type != SHT_NOBITS
+	  && (shdr->sh_offset > map_size
+	      || shdr->sh_size > map_size - shdr->sh_offset))
+	break;
+    }
+  /* Only the empty section zero, not worth a thread.  */
+  if (n <= 1)
+    return;
+
+  void *map = mmap (NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return;
+
+  struct build_id_hash *bh = malloc (sizeof *bh);
+  if (bh == NULL)
+    {
+      munmap (map, map_size);
+      return;
+    }
+  bh->map = map;
+  bh->map_size = map_size;
+  bh->nscns = n;
+  bh->shdrs = malloc (n * sizeof *bh->shdrs);
+  bh->offsets = malloc (n * sizeof *bh->offsets);
+  if (bh->shdrs == NULL || bh->offsets == NULL)
+    {
+      munmap (map, map_size);
+      free (bh->shdrs);
+      free (bh->offsets);
+      free (bh);
+      return;
+    }
+  for (int i = 0; i < n; ++i)
+    {
+      build_id_hash_shdr (dso, i, &bh->shdrs[i]);
+      bh->offsets[i] = dso->shdr[i].sh_offset;
+    }
+  bh->note_scn = note_scn < n ? note_scn : -1;
+  bh->note_off = note_off;
+  bh->note_size = note_size;
+  size_t mark = cleanups_mark ();
+  push_cleanup (cleanup_munmap, map, map_size);
+  push_cleanup (cleanup_free, bh->shdrs, 0);
+  push_cleanup (cleanup_free, bh->offsets, 0);
+  push_cleanup (cleanup_free, bh, 0);
+  bh->state = build_id_hash_start (dso);
+  drop_cleanups (mark);
+
+  if (pthread_create (&bh->thread, NULL, build_id_hash_thread, bh) != 0)
+    {
+      XXH3_freeState (bh->state);
+      munmap (map, map_size);
+      free (bh->shdrs);
+      free (bh->offsets);
+      free (bh);
+      return;
+    }
+
+  dso->build_id_hash = bh;
+}
+
+/* Wait for the background build-id hashing started for DSO (if any).
+   Returns the hash state and sets *NSCNS to the number of sections
+   already hashed, or returns NULL.  */
+static XXH3_state_t *
+finish_build_id_hash (DSO *dso, int *nscns)
+{
+  struct build_id_hash *bh = dso->build_id_hash;
+  if (bh == NULL)
+    return NULL;
+
+  int err = pthread_join (bh->thread, NULL);
+  if (err != 0)
+    error (1, err, "Failed to wait for build-id hashing");
+
+  XXH3_state_t *state = bh->state;
+  *nscns = bh->nscns;
+  munmap ((void *) bh->map, bh->map_size);
+  free (bh->shdrs);
+  free (bh->offsets);
+  free (bh);
+  dso->build_id_hash = NULL;
+  return state;
+}
+
+/* Get the contents of section SEC of DSO to feed into the build-id
+   hash.  These come straight from the file mapping when possible.  */
+static void
+build_id_section_data (DSO *dso, int sec, const void **buf, size_t *size)
+{
+  if (dso->rawfile != NULL)
+    {
+      if (dso->rawnote != NULL && sec == dso->rawnote_scn)
+	*buf = dso->rawnote;
+      else
+	*buf = dso->rawfile + dso->shdr[sec].sh_offset;
+      *size = dso->shdr[sec].sh_size;
+      return;
+    }
+
+  Elf_Data *d = elf_getdata (dso->scn[sec], NULL);
+  if (d == NULL)
+    error (1, 0, "Failed to compute header checksum: %s",
+	   elf_errmsg (elf_errno ()));
+  *buf = d->d_buf;
+  *size = d->d_size;
+}
+
+/* With --build-id-mode=tree section contents are cut into chunks of
+   this size that are hashed independently.  Changing this changes the
+   resulting build-ids.  */
+#define BUILD_ID_CHUNK_SIZE (1024 * 1024)
+
+struct build_id_chunk
+{
+  const unsigned char *buf;
+  size_t size;
+  XXH128_canonical_t hash;
+};
+
+struct build_id_worker
+{
+  pthread_t thread;
+  struct build_id_chunk *chunks;
+  size_t nchunks;
+  /* Hash chunks first, first + stride, first + 2 * stride, etc.  */
+  size_t first;
+  size_t stride;
+};
+
+static void *
+build_id_chunk_thread (void *arg)
+{
+  struct build_id_worker *w = arg;
+  for (size_t c = w->first; c < w->nchunks; c += w->stride)
+    XXH128_canonicalFromHash (&w->chunks[c].hash,
+			      XXH3_128bits (w->chunks[c].buf,
+					    w->chunks[c].size));
+  return NULL;
+}
+
+/* Feed the section headers and contents of DSO into STATE as a tree:
+   each section header followed by the hashes of the section contents
+   cut into BUILD_ID_CHUNK_SIZE chunks.  The chunks are hashed using
+   up to jobs threads.  */
+static void
+build_id_hash_tree (DSO *dso, XXH3_state_t *state)
+{
+  int shnum = dso->ehdr.e_shnum;
+  size_t *first_chunk = malloc ((shnum + 1) * sizeof (size_t));
+  if (first_chunk == NULL)
+    error (1, errno, "Couldn't allocate build-id chunks");
+  size_t mark = cleanups_mark ();
+  push_cleanup (cleanup_free, first_chunk, 0);
+
+  /* libelf isn't thread-safe, so get all section data first.  */
+  size_t nchunks = 0, allocated = 0;
+  struct build_id_chunk *chunks = NULL;
+  size_t chunks_cleanup = push_cleanup (cleanup_free, NULL, 0);
+  for (int i = 0; i < shnum; ++i)
+    {
+      first_chunk[i] = nchunks;
+      if (dso->scn[i] == NULL || dso->shdr[i].sh_type == SHT_NOBITS)
+	continue;
+
+      const void *buf;
+      size_t size;
+      build_id_section_data (dso, i, &buf, &size);
+
+      for (size_t off = 0; off < size; off += BUILD_ID_CHUNK_SIZE)
+	{
+	  if (nchunks == allocated)
+	    {
+	      allocated = allocated == 0 ? 64 : 2 * allocated;
+	      struct build_id_chunk *new_chunks
+		= realloc (chunks, allocated * sizeof *chunks);
+	      if (new_chunks == NULL)
+		error (1, errno, "Couldn't allocate build-id chunks");
+	      chunks = new_chunks;
+	      set_cleanup (chunks_cleanup, chunks, 0);
+	    }
+	  chunks[nchunks].buf = (const unsigned char *) buf + off;
+	  chunks[nchunks].size = MIN (size - off,
+				      (size_t) BUILD_ID_CHUNK_SIZE);
+	  nchunks++;
+	}
+    }
+  first_chunk[shnum] = nchunks;
+
+  size_t nworkers = MAX (1, MIN ((size_t) jobs, nchunks));
+  struct build_id_worker *workers = malloc (nworkers * sizeof *workers);
+  if (workers == NULL)
+    error (1, errno, "Couldn't allocate build-id workers");
+  push_cleanup (cleanup_free, workers, 0);
+  for (size_t w = 0; w < nworkers; ++w)
+    {
+      workers[w].chunks = chunks;
+      workers[w].nchunks = nchunks;
+      workers[w].first = w;
+      workers[w].stride = nworkers;
+    }
+  /* The main thread does the first share itself.  */
+  for (size_t w = 1; w < nworkers; ++w)
+    {
+      int err = pthread_create (&workers[w].thread, NULL,
+				build_id_chunk_thread, &workers[w]);
+      if (err != 0)
+	{
+	  /* Don't leave the threads already started running on the
+	     chunks that are about to be freed.  */
+	  while (--w > 0)
+	    pthread_join (workers[w].thread, NULL);
+	  error (1, err, "Failed to start build-id hashing thread");
+	}
+    }
+  build_id_chunk_thread (&workers[0]);
+  for (size_t w = 1; w < nworkers; ++w)
+    {
+      int err = pthread_join (workers[w].thread, NULL);
+      if (err != 0)
+	error (1, err, "Failed to wait for build-id hashing");
+    }
+
+  for (int i = 0; i < shnum; ++i)
+    if (dso->scn[i] != NULL)
+      {
+	GElf_Shdr shdr;
+	build_id_hash_shdr (dso, i, &shdr);
+	XXH3_128bits_update (state, &shdr, sizeof shdr);
+
+	for (size_t c = first_chunk[i]; c < first_chunk[i + 1]; ++c)
+	  XXH3_128bits_update (state, &chunks[c].hash,
+			       sizeof chunks[c].hash);
+      }
+
+  drop_cleanups (mark);
+  free (workers);
+  free (chunks);
+  free (first_chunk);
+}
+
+/* Add the SIZE build-id bits at ID to the build-ids of the current
+   context, for debugedit_build_id.  */
+static void
+record_build_id (const unsigned char *id, size_t size)
+{
+  struct debugedit *ctx = cur_ctx;
+  size_t n = ctx->nbuild_ids;
+  size_t start = n == 0 ? 0 : ctx->build_id_ends[n - 1];
+  unsigned char *ids = realloc (ctx->build_ids, start + size);
+  if (ids == NULL)
+    error (1, ENOMEM, "Couldn't record build ID");
+  ctx->build_ids = ids;
+  size_t *ends = realloc (ctx->build_id_ends, (n + 1) * sizeof (size_t));
+  if (ends == NULL)
+    error (1, ENOMEM, "Couldn't record build ID");
+  ctx->build_id_ends = ends;
+
+  memcpy (ids + start, id, size);
+  ends[n] = start + size;
+  ctx->nbuild_ids = n + 1;
+}
+
+/* Compute a fresh build ID bit-string from the editted file contents.
+   Returns true if the build ID bits were recomputed.  */
+static bool
+handle_build_id (DSO *dso, Elf_Data *build_id,
+		 size_t build_id_offset, size_t build_id_size)
+{
+  /* Accept any build_id_size > 0.  Hashes will be truncated or padded
+     to the incoming note size, as debugedit cannot change their
+     size. */
+  if (build_id_size <= 0)
+    {
+      error (1, 0, "Cannot handle %zu-byte build ID", build_id_size);
+    }
+
+  bool recomputed = true;
+  int i = 0;
+  XXH3_state_t *state = finish_build_id_hash (dso, &i);
+  if (no_recompute_build_id
+      || (! dirty_elf && build_id_seed == NULL))
+    {
+      if (state != NULL)
+	XXH3_freeState (state);
+      recomputed = false;
+      goto print;
+    }
+
+  /* Clear the bits about to be recomputed, so they do not affect the
+     new hash.  Extra bits left over from wider-than-128-bit hash are
+     preserved for extra entropy.  This computation should be
+     idempotent, so repeated rehashes (with the same seed) should
+     result in the same hash. */
+  XXH128_canonical_t result_canon;
+  memset ((char *) build_id->d_buf + build_id_offset, 0,
+          MIN (build_id_size, sizeof(result_canon)));
+
+  if (state == NULL)
+    state = build_id_hash_start (dso);
+  size_t mark = cleanups_mark ();
+  push_cleanup (cleanup_xxh3_state, state, 0);
+
+  /* Slurp the section headers and contents not yet hashed in the
+     background and feed them into the hash function.  */
+  if (build_id_tree)
+    build_id_hash_tree (dso, state);
+  else
+    for (; i < dso->ehdr.e_shnum; ++i)
+      if (dso->scn[i] != NULL)
+	{
+	  GElf_Shdr shdr;
+	  build_id_hash_shdr (dso, i, &shdr);
+	  XXH3_128bits_update (state, &shdr, sizeof shdr);
+
+	  if (dso->shdr[i].sh_type != SHT_NOBITS)
+	    {
+	      const void *buf;
+	      size_t size;
+	      build_id_section_data (dso, i, &buf, &size);
+	      XXH3_128bits_update (state, buf, size);
+	    }
+	}
+
+  XXH128_hash_t result = XXH3_128bits_digest (state);
+  drop_cleanups (mark);
+  XXH3_freeState (state);
+  /* Use canonical-endianness output. */
+  XXH128_canonicalFromHash (&result_canon, result);
+  memcpy((unsigned char *)build_id->d_buf + build_id_offset, &result_canon,
+         MIN (build_id_size, sizeof(result_canon)));
+
+  elf_flagdata (build_id, ELF_C_SET, ELF_F_DIRTY);
+
+ print:
+  record_build_id ((unsigned char *) build_id->d_buf + build_id_offset,
+		   build_id_size);
+
+  return recomputed;
+}
+
+/* Only the build ID is (re)computed, so the sections don't have to be
+   read in and written out by libelf.  Hash the section contents
+   straight from the file mapping libelf made if the file has the host
+   byte order, then write back just the build ID bits of note section
+   NOTE_SCN into FD.  Returns true if the file was written to.  */
+static bool
+handle_build_id_only (DSO *dso, int fd, int note_scn, Elf_Data *build_id,
+		      size_t build_id_offset, size_t build_id_size)
+{
+  size_t size;
+  const unsigned char *raw = (const unsigned char *) elf_rawfile (dso->elf,
+								   &size);
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+  if (dso->ehdr.e_ident[EI_DATA] != ELFDATA2LSB)
+    raw = NULL;
+#else
+  if (dso->ehdr.e_ident[EI_DATA] != ELFDATA2MSB)
+    raw = NULL;
+#endif
+  for (int i = 0; raw != NULL && i < dso->ehdr.e_shnum; ++i)
+    if (dso->shdr[i].sh_type != SHT_NOBITS
+	&& (dso->shdr[i].sh_offset > size
+	    || dso->shdr[i].sh_size > size - dso->shdr[i].sh_offset))
+      raw = NULL;
+  dso->rawfile = raw;
+
+  /* handle_build_id clears the build-id bits in the note section data,
+     but that might not be the bytes of the mapping.  Hash them as zeros
+     explicitly, like build_id_hash_thread does.  */
+  if (raw != NULL)
+    {
+      size_t note_size = dso->shdr[note_scn].sh_size;
+      if (build_id_offset > note_size)
+	error (1, 0, "%s: Bad build ID note", dso->filename);
+      dso->rawnote = malloc (note_size);
+      if (dso->rawnote == NULL)
+	error (1, ENOMEM, "%s: Couldn't copy build ID note", dso->filename);
+      memcpy (dso->rawnote, raw + dso->shdr[note_scn].sh_offset, note_size);
+      memset (dso->rawnote + build_id_offset, 0,
+	      MIN (build_id_size, MIN (note_size - build_id_offset,
+				       sizeof (XXH128_canonical_t))));
+      dso->rawnote_scn = note_scn;
+    }
+
+  if (handle_build_id (dso, build_id, build_id_offset, build_id_size))
+    {
+      off_t off = dso->shdr[note_scn].sh_offset + build_id_offset;
+      const char *id = (const char *) build_id->d_buf + build_id_offset;
+
+      /* Leave the file alone if the build ID came out the same.  */
+      char *old_id = malloc (build_id_size);
+      bool same = (old_id != NULL
+		   && pread (fd, old_id, build_id_size, off)
+		      == (ssize_t) build_id_size
+		   && memcmp (old_id, id, build_id_size) == 0);
+      free (old_id);
+      if (same)
+	return false;
+
+      if (pwrite (fd, id, build_id_size, off) != (ssize_t) build_id_size)
+	error (1, errno, "Failed to write build ID to '%s'", dso->filename);
+      return true;
+    }
+  return false;
+}
+
+/* Forget the debug sections of the previous DSO, and what needed
+   updating in them, so the next DSO (archive member) starts fresh.  */
+static void
+reset_debug_sections (void)
+{
+  for (int i = 0; debug_sections[i].name; ++i)
+    {
+      struct debug_section *sec = &debug_sections[i];
+      const char *name = sec->name;
+
+      /* In case there were multiple (COMDAT) .debug_macro,
+	 .debug_types or .debug_info sections, free them.  */
+      struct debug_section *next = sec->next;
+      while (next != NULL)
+	{
+	  struct debug_section *n = next->next;
+	  free (next->relbuf);
+	  if (next->map != NULL)
+	    munmap (next->map, next->map_size);
+	  free (next);
+	  next = n;
+	}
+
+      free (sec->relbuf);
+      if (sec->map != NULL)
+	munmap (sec->map, sec->map_size);
+      memset (sec, 0, sizeof (*sec));
+      sec->name = name;
+    }
+
+  need_string_replacement = false;
+  need_strp_update = false;
+  need_line_strp_update = false;
+  need_stmt_update = false;
+  recompressed = false;
+  dirty_elf = 0;
+  last_relptr = NULL;
+  last_relend = NULL;
+  last_reltype = 0;
+  last_sec = NULL;
+}
+
+/* Frees DSO, except for its Elf.  */
+static void
+free_dso (DSO *dso)
+{
+  /* Only still running when editing failed.  */
+  struct build_id_hash *bh = dso->build_id_hash;
+  if (bh != NULL)
+    {
+      pthread_join (bh->thread, NULL);
+      XXH3_freeState (bh->state);
+      munmap ((void *) bh->map, bh->map_size);
+      free (bh->shdrs);
+      free (bh->offsets);
+      free (bh);
+    }
+
+  free ((char *) dso->filename);
+  destroy_strings (&dso->debug_str);
+  destroy_strings (&dso->debug_line_str);
+  destroy_lines (&dso->lines);
+  destroy_arena (&dso->arena);
+  destroy_scn_bufs (dso);
+  if (dso->dir_prefixes != NULL)
+    htab_delete (dso->dir_prefixes);
+  free (dso->rel_syms);
+  free (dso->contribs);
+  free (dso->rawnote);
+  free (dso);
+}
+
+/* Whether writing out the edited DSO would give exactly the bytes that
+   are already in its file, then the write is skipped so the file, its
+   mtime and the page cache stay as they are.  Compares the laid out
+   headers and all section data with a second, read only, view of the
+   file.  */
+static bool
+elf_unchanged (DSO *dso)
+{
+  Elf *orig = elf_begin (dso->fd, ELF_C_READ_MMAP, NULL);
+  if (orig == NULL)
+    return false;
+
+  bool same = false;
+  GElf_Ehdr ehdr, orig_ehdr;
+  size_t phnum, orig_phnum;
+  if (gelf_getehdr (dso->elf, &ehdr) == NULL
+      || gelf_getehdr (orig, &orig_ehdr) == NULL
+      || memcmp (&ehdr, &orig_ehdr, sizeof ehdr) != 0
+      || elf_getphdrnum (dso->elf, &phnum) != 0
+      || elf_getphdrnum (orig, &orig_phnum) != 0
+      || phnum != orig_phnum)
+    goto out;
+
+  for (size_t i = 0; i < phnum; i++)
+    {
+      GElf_Phdr phdr, orig_phdr;
+      if (gelf_getphdr (dso->elf, i, &phdr) == NULL
+	  || gelf_getphdr (orig, i, &orig_phdr) == NULL
+	  || memcmp (&phdr, &orig_phdr, sizeof phdr) != 0)
+	goto out;
+    }
+
+  Elf_Scn *scn = NULL, *orig_scn = NULL;
+  while ((scn = elf_nextscn (dso->elf, scn)) != NULL)
+    {
+      GElf_Shdr shdr, orig_shdr;
+      orig_scn = elf_nextscn (orig, orig_scn);
+      if (orig_scn == NULL
+	  || gelf_getshdr (scn, &shdr) == NULL
+	  || gelf_getshdr (orig_scn, &orig_shdr) == NULL
+	  || memcmp (&shdr, &orig_shdr, sizeof shdr) != 0)
+	goto out;
+      if (shdr.sh_type == SHT_NOBITS)
+	continue;
+
+      Elf_Data *data = NULL, *orig_data = NULL;
+      while ((data = elf_getdata (scn, data)) != NULL)
+	{
+	  orig_data = elf_getdata (orig_scn, orig_data);
+	  if (orig_data == NULL
+	      || data->d_off != orig_data->d_off
+	      || data->d_size != orig_data->d_size
+	      || (data->d_size != 0
+		  && memcmp (data->d_buf, orig_data->d_buf,
+			     data->d_size) != 0))
+	    goto out;
+	}
+      if (elf_getdata (orig_scn, orig_data) != NULL)
+	goto out;
+    }
+  same = elf_nextscn (orig, orig_scn) == NULL;
+
+ out:
+  elf_end (orig);
+  return same;
+}
+
+/* Adds what editing DSO would change to check_result, without changing
+   anything.  */
+static void
+check_file (DSO *dso)
+{
+  bool has_info = false;
+  for (int i = 1; i < dso->ehdr.e_shnum; i++)
+    {
+      const char *name;
+      if ((dso->shdr[i].sh_flags & SHF_ALLOC) != 0
+	  || dso->shdr[i].sh_type == SHT_NOBITS
+	  || (name = strptr (dso, dso->ehdr.e_shstrndx,
+			     dso->shdr[i].sh_name)) == NULL
+	  || strncmp (name, ".debug_", sizeof (".debug_") - 1) != 0)
+	continue;
+
+      check_result->debug_size += dso->shdr[i].sh_size;
+      if (debug_section_name_eq (name, ".debug_info")
+	  || debug_section_name_eq (name, ".debug_types"))
+	check_result->info_size += dso->shdr[i].sh_size;
+      if (debug_section_name_eq (name, ".debug_info"))
+	has_info = true;
+    }
+
+  /* Phase zero of edit_dwarf2 finds out whether any paths change.  */
+  bool paths = false;
+  if (prefix_maps != NULL && has_info)
+    {
+      edit_dwarf2 (dso);
+      paths = paths_changed ();
+    }
+  bool compress = compression_changes (dso);
+
+  Elf_Data *build_id = NULL;
+  size_t build_id_offset, build_id_size;
+  if (do_build_id)
+    find_build_id (dso, &build_id, &build_id_offset, &build_id_size);
+
+  if (paths)
+    check_result->needs |= DEBUGEDIT_NEEDS_PATHS;
+  if (compress)
+    check_result->needs |= DEBUGEDIT_NEEDS_COMPRESS;
+  /* Same as handle_build_id.  */
+  if (build_id != NULL && ! no_recompute_build_id
+      && (paths || compress || build_id_seed != NULL))
+    check_result->needs |= DEBUGEDIT_NEEDS_BUILD_ID;
+}
+
+/* Edits the ELF file open as FD, called FILE in messages, in place.
+   Returns true if the file was written to.  */
+static bool
+edit_file (int fd, const char *file)
+{
+  DSO *dso;
+  int i;
+  Elf_Data *build_id = NULL;
+  size_t build_id_offset = 0, build_id_size = 0;
+  bool written = false;
+  bool dwarf_edited = false;
+
+  dso = fdopen_dso (fd, file);
+
+  if (check_result != NULL)
+    {
+      check_file (dso);
+      goto done;
+    }
+
+  int note_scn = 0;
+  if (do_build_id)
+    {
+      note_scn = find_build_id (dso, &build_id, &build_id_offset,
+				&build_id_size);
+      /* Only worth it if the build-id will (likely) be recomputed.  */
+      if (build_id != NULL && ! no_recompute_build_id && ! build_id_tree
+	  && ! build_id_only && (build_id_seed != NULL || prefix_maps != NULL))
+	start_build_id_hash (dso, fd, note_scn,
+			     build_id_offset, build_id_size);
+    }
+
+  if (build_id_only)
+    {
+      if (build_id != NULL)
+	written = handle_build_id_only (dso, fd, note_scn, build_id,
+					build_id_offset, build_id_size);
+      goto done;
+    }
+
+  for (i = 1; i < dso->ehdr.e_shnum; i++)
+    {
+      const char *name;
+
+      switch (dso->shdr[i].sh_type)
+	{
+	case SHT_MIPS_DWARF:
+	  /* According to the specification, all MIPS .debug_* sections are
+	     marked with ELF type SHT_MIPS_DWARF. As SHT_MIPS_DWARF is from
+	     processor-specific range, we have to check that we're actually
+	     dealing with MIPS ELF file before handling such sections.  */
+	  if (dso->ehdr.e_machine != EM_MIPS
+	      && dso->ehdr.e_machine != EM_MIPS_RS3_LE) {
+	    break;
+	  }
+	  /*@fallthrough@*/
+	case SHT_PROGBITS:
+	  name = strptr (dso, dso->ehdr.e_shstrndx, dso->shdr[i].sh_name);
+	  /* TODO: Handle stabs */
+	  if (name != NULL && strcmp (name, ".stab") == 0)
+	    {
+	      error (0, 0, "Stabs debuginfo not supported: %s", file);
+	      break;
+	    }
+	  /* We only have to go over the DIE tree if we are rewriting paths
+	     or listing sources.  Once, there might be multiple (COMDAT)
+	     .debug_info sections.  */
+	  if ((base_dir != NULL || prefix_maps != NULL || list_file_fd != -1)
+	      && name != NULL && debug_section_name_eq (name, ".debug_info")
+	      && ! dwarf_edited)
+	    {
+	      edit_dwarf2 (dso);
+	      dwarf_edited = true;
+	    }
+
+	  break;
+	default:
+	  break;
+	}
+    }
+
+  if (list_file_fd != -1)
+    list_file_flush ();
+
+  /* Recompress any debug sections that might have been uncompressed.  */
+  recompress_debug_sections (dso);
+
+  /* Normally we only need to explicitly update the section headers
+     and data when any section data changed size. But because of a bug
+     in elfutils before 0.169 we will have to update and write out all
+     section data if any data has changed (when ELF_F_LAYOUT was
+     set). https://sourceware.org/bugzilla/show_bug.cgi?id=21199 */
+  bool need_update = (need_strp_update
+		      || need_line_strp_update
+		      || need_stmt_update
+		      || recompressed);
+
+#if !_ELFUTILS_PREREQ (0, 169)
+  /* string replacements or build_id updates don't change section size. */
+  need_update = (need_update
+		 || need_string_replacement
+		 || (do_build_id && build_id != NULL));
+#endif
+
+  /* We might have changed the size of some debug sections. If so make
+     sure the section headers are updated and the data offsets are
+     correct. We set ELF_F_LAYOUT above because we don't want libelf
+     to move any allocated sections around itself if there are any
+     phdrs. Which means we are responsible for setting the section size
+     and offset fields. Plus the shdr offsets. We don't want to change
+     anything for the phdrs allocated sections. Keep the offset of
+     allocated sections so they are at the same place in the file. Add
+     unallocated ones after the allocated ones. */
+  if (dso->phnum != 0 && need_update)
+    {
+      Elf *elf = dso->elf;
+      GElf_Off last_offset;
+      /* We position everything after the phdrs (which normally would
+	 be at the start of the ELF file after the ELF header. */
+      last_offset = (dso->ehdr.e_phoff + gelf_fsize (elf, ELF_T_PHDR,
+						     dso->phnum, EV_CURRENT));
+
+      /* First find the last allocated section.  */
+      Elf_Scn *scn = NULL;
+      while ((scn = elf_nextscn (elf, scn)) != NULL)
+	{
+	  GElf_Shdr shdr_mem;
+	  GElf_Shdr *shdr = gelf_getshdr (scn, &shdr_mem);
+	  if (shdr == NULL)
+	    error (1, 0, "Couldn't get shdr: %s", elf_errmsg (-1));
+
+	  /* Any sections we have changed aren't allocated sections,
+	     so we don't need to lookup any changed section sizes. */
+	  if ((shdr->sh_flags & SHF_ALLOC) != 0)
+	    {
+	      GElf_Off off = shdr->sh_offset + (shdr->sh_type != SHT_NOBITS
+						? shdr->sh_size : 0);
+	      if (last_offset < off)
+		last_offset = off;
+	    }
+	}
+
+      /* Now adjust any sizes and offsets for the unallocated sections. */
+      scn = NULL;
+      while ((scn = elf_nextscn (elf, scn)) != NULL)
+	{
+	  GElf_Shdr shdr_mem;
+	  GElf_Shdr *shdr = gelf_getshdr (scn, &shdr_mem);
+	  if (shdr == NULL)
+	    error (1, 0, "Couldn't get shdr: %s", elf_errmsg (-1));
+
+	  /* A bug in elfutils before 0.169 means we have to write out
+	     all section data, even when nothing changed.
+	     https://sourceware.org/bugzilla/show_bug.cgi?id=21199 */
+#if !_ELFUTILS_PREREQ (0, 169)
+	  if (shdr->sh_type != SHT_NOBITS)
+	    {
+	      Elf_Data *d = elf_getdata (scn, NULL);
+	      elf_flagdata (d, ELF_C_SET, ELF_F_DIRTY);
+	    }
+#endif
+	  if ((shdr->sh_flags & SHF_ALLOC) == 0)
+	    {
+	      GElf_Off sec_offset = shdr->sh_offset;
+	      GElf_Xword sec_size = shdr->sh_size;
+
+	      /* We might have changed the size (and content) of the
+		 debug_str, debug_line_str or debug_line section. */
+	      size_t secnum = elf_ndxscn (scn);
+	      if (secnum == debug_sections[DEBUG_STR].sec)
+		sec_size = debug_sections[DEBUG_STR].size;
+	      if (secnum == debug_sections[DEBUG_LINE_STR].sec)
+		sec_size = debug_sections[DEBUG_LINE_STR].size;
+	      if (secnum == debug_sections[DEBUG_LINE].sec)
+		sec_size = debug_sections[DEBUG_LINE].size;
+
+	      /* Zero means one.  No alignment constraints.  */
+	      size_t addralign = shdr->sh_addralign ?: 1;
+	      last_offset = (last_offset + addralign - 1) & ~(addralign - 1);
+	      sec_offset = last_offset;
+	      if (shdr->sh_type != SHT_NOBITS)
+		last_offset += sec_size;
+
+	      if (shdr->sh_size != sec_size
+		  || shdr->sh_offset != sec_offset)
+		{
+		  /* Make sure unchanged section data is written out
+		     at the new location. */
+		  if (shdr->sh_offset != sec_offset
+		      && shdr->sh_type != SHT_NOBITS)
+		    {
+		      Elf_Data *d = elf_getdata (scn, NULL);
+		      elf_flagdata (d, ELF_C_SET, ELF_F_DIRTY);
+		    }
+
+		  shdr->sh_size = sec_size;
+		  shdr->sh_offset = sec_offset;
+		  if (gelf_update_shdr (scn, shdr) == 0)
+		    error (1, 0, "Couldn't update shdr: %s",
+			   elf_errmsg (-1));
+		}
+	    }
+	}
+
+      /* Position the shdrs after the last (unallocated) section.  */
+      const size_t offsize = gelf_fsize (elf, ELF_T_OFF, 1, EV_CURRENT);
+      GElf_Off new_offset = ((last_offset + offsize - 1)
+			     & ~((GElf_Off) (offsize - 1)));
+      if (dso->ehdr.e_shoff != new_offset)
+	{
+	  dso->ehdr.e_shoff = new_offset;
+	  if (gelf_update_ehdr (elf, &dso->ehdr) == 0)
+	    error (1, 0, "Couldn't update ehdr: %s", elf_errmsg (-1));
+	}
+    }
+
+  /* If we have done any string replacement or rewrote any section
+     data or did a build_id rewrite we need to write out the new ELF
+     image.  */
+  bool need_write = (need_string_replacement
+		     || need_strp_update
+		     || need_line_strp_update
+		     || need_stmt_update
+		     || dirty_elf
+		     || (build_id && !no_recompute_build_id)
+		     || recompressed);
+
+  /* Laying out the file reads in all section data, don't bother when
+     only listing sources.  */
+  if (need_write || (do_build_id && build_id != NULL))
+    {
+      if (elf_update (dso->elf, ELF_C_NULL) < 0)
+	{
+	  error (1, 0, "Failed to update file: %s",
+		 elf_errmsg (elf_errno ()));
+	}
+    }
+
+  if (do_build_id && build_id != NULL)
+    handle_build_id (dso, build_id, build_id_offset, build_id_size);
+
+  /* The new strings, line tables, build ID or compression might all
+     come out the same as before.  */
+  if (need_write && ! elf_unchanged (dso))
+    {
+      if (elf_update (dso->elf, ELF_C_WRITE) < 0)
+	error (1, 0, "Failed to write file: %s", elf_errmsg (elf_errno()));
+      written = true;
+    }
+
+ done:
+  cur_ctx->dso = NULL;
+  int ended = elf_end (dso->elf);
+  free_dso (dso);
+  if (ended < 0)
+    {
+      error (1, 0, "elf_end failed: %s", elf_errmsg (elf_errno()));
+    }
+
+  reset_debug_sections ();
+
+  return written;
+}
+
+/* Whether FD starts with an ar archive (or thin archive) magic.  */
+static bool
+is_archive (int fd)
+{
+  char magic[SARMAG];
+  return (pread (fd, magic, SARMAG, 0) == SARMAG
+	  && (memcmp (magic, ARMAG, SARMAG) == 0
+	      || memcmp (magic, "!<thin>\n", SARMAG) == 0));
+}
+
+/* Returns a new, already unlinked, file to hold an edited archive
+   (member).  NAME is only used in messages (and /proc).  */
+static int
+open_anon_file (const char *name)
+{
+#ifdef HAVE_MEMFD_CREATE
+  int fd = memfd_create (name, MFD_CLOEXEC);
+  if (fd >= 0)
+    return fd;
+#endif
+  return open_temp_file (name);
+}
+
+static void
+pwrite_full (int fd, const void *buf, size_t size, off_t off,
+	     const char *name)
+{
+  const char *p = buf;
+  while (size > 0)
+    {
+      ssize_t ret = pwrite (fd, p, size, off);
+      if (ret <= 0)
+	error (1, ret == 0 ? EIO : errno, "Could not write '%s'", name);
+      size -= ret;
+      p += ret;
+      off += ret;
+    }
+}
+
+/* Where a member header was in the original archive and where it
+   ended up in the edited one.  */
+struct ar_offset
+{
+  off_t old_off;
+  off_t new_off;
+};
+
+static int
+ar_offset_cmp (const void *a, const void *b)
+{
+  const struct ar_offset *oa = a, *ob = b;
+  return (oa->old_off > ob->old_off) - (oa->old_off < ob->old_off);
+}
+
+/* The archive symbol table ("/" or "/SYM64/" for 64-bit offsets)
+   maps symbol names to the offsets of the member headers defining
+   them.  Rewrite those offsets in the SIZE bytes at SYMTAB for the new
+   member positions in OFFSETS.  */
+static void
+fixup_ar_symtab (unsigned char *symtab, size_t size, bool is64,
+		 struct ar_offset *offsets, size_t noffsets,
+		 const char *file)
+{
+  size_t entsize = is64 ? 8 : 4;
+  uint64_t count = 0, i;
+  size_t j;
+
+  if (size < entsize)
+    error (1, 0, "%s: Bad archive symbol table", file);
+  for (j = 0; j < entsize; j++)
+    count = (count << 8) | symtab[j];
+  if (count > size / entsize - 1)
+    error (1, 0, "%s: Bad archive symbol table", file);
+
+  for (i = 1; i <= count; i++)
+    {
+      unsigned char *p = symtab + i * entsize;
+      struct ar_offset key = { 0, 0 }, *found;
+      uint64_t off = 0;
+      for (j = 0; j < entsize; j++)
+	off = (off << 8) | p[j];
+      key.old_off = off;
+      found = bsearch (&key, offsets, noffsets, sizeof (struct ar_offset),
+		       ar_offset_cmp);
+      if (found == NULL)
+	error (1, 0, "%s: Archive symbol table entry for unknown member"
+	       " at 0x%" PRIx64, file, off);
+      off = found->new_off;
+      for (j = entsize; j > 0; j--)
+	{
+	  p[j - 1] = off & 0xff;
+	  off >>= 8;
+	}
+    }
+}
+
+/* Edits each ELF member of the (non-thin) ar archive open as FD,
+   called FILE in messages, as if it was given on its own.  The members
+   are edited in memory and the archive is rebuilt next to it with the
+   original member headers, only the sizes are updated.  When any
+   member changed it replaces the contents of FD.  Returns true if FD
+   was written to.  */
+static bool
+edit_archive (int fd, const char *file)
+{
+  size_t mark = cleanups_mark ();
+  Elf *ar = elf_begin (fd, ELF_C_READ_MMAP, NULL);
+  if (ar == NULL)
+    error (1, 0, "cannot open archive '%s': %s", file, elf_errmsg (-1));
+  size_t ar_cleanup = push_cleanup (cleanup_elf_end, ar, 0);
+  if (elf_kind (ar) != ELF_K_AR)
+    error (1, 0, "cannot open archive '%s': %s", file, elf_errmsg (-1));
+
+  size_t arsize;
+  const char *image = elf_rawfile (ar, &arsize);
+  if (image == NULL || arsize < SARMAG
+      || memcmp (image, ARMAG, SARMAG) != 0)
+    error (1, 0, "\"%s\" is not a regular ar archive", file);
+
+  int out = open_anon_file (file);
+  push_cleanup (cleanup_close, NULL, out);
+  off_t outsize = 0;
+  pwrite_full (out, image, SARMAG, outsize, file);
+  outsize += SARMAG;
+
+  struct ar_offset *offsets = NULL;
+  size_t noffsets = 0, offsets_alloc = 0;
+  size_t offsets_cleanup = push_cleanup (cleanup_free, NULL, 0);
+  const unsigned char *symtab = NULL;
+  size_t symtab_size = 0;
+  off_t symtab_off = 0;
+  bool symtab64 = false;
+  bool changed = false;
+
+  Elf_Cmd cmd = ELF_C_READ_MMAP;
+  Elf *member;
+  while ((member = elf_begin (fd, cmd, ar)) != NULL)
+    {
+      size_t member_mark = cleanups_mark ();
+      push_cleanup (cleanup_elf_end, member, 0);
+      Elf_Arhdr *arhdr = elf_getarhdr (member);
+      off_t aroff = elf_getaroff (member);
+      struct ar_hdr hdr;
+      size_t size;
+      const char *data = elf_rawfile (member, &size);
+      char *name = NULL;
+      void *map = NULL;
+      int mfd = -1;
+
+      if (arhdr == NULL || aroff < 0
+	  || (size_t) aroff + sizeof (hdr) > arsize)
+	error (1, 0, "%s: Bad archive member: %s", file, elf_errmsg (-1));
+      memcpy (&hdr, image + aroff, sizeof (hdr));
+
+      if (strcmp (arhdr->ar_name, "/") == 0
+	  || strcmp (arhdr->ar_name, "/SYM64/") == 0)
+	{
+	  symtab = (const unsigned char *) data;
+	  symtab_size = size;
+	  symtab_off = outsize + sizeof (hdr);
+	  symtab64 = arhdr->ar_name[1] != '\0';
+	}
+      /* BSD style "#1/len" names are stored in front of the member
+	 data, just copy those members.  */
+      else if (elf_kind (member) == ELF_K_ELF
+	       && strncmp (arhdr->ar_rawname, "#1/", 3) != 0)
+	{
+	  if (asprintf (&name, "%s(%s)", file, arhdr->ar_name) < 0)
+	    error (1, ENOMEM, "%s: Could not allocate memory", file);
+	  push_cleanup (cleanup_free, name, 0);
+	  mfd = open_anon_file (name);
+	  push_cleanup (cleanup_close, NULL, mfd);
+	  pwrite_full (mfd, data, size, 0, name);
+	  if (edit_file (mfd, name))
+	    {
+	      struct stat st;
+	      if (fstat (mfd, &st) != 0)
+		error (1, errno, "Could not stat '%s'", name);
+	      size = st.st_size;
+	      if (size > 0)
+		{
+		  map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, mfd, 0);
+		  if (map == MAP_FAILED)
+		    error (1, errno, "Could not map '%s'", name);
+		  push_cleanup (cleanup_munmap, map, size);
+		}
+	      data = map;
+	      changed = true;
+	    }
+	}
+
+      if (noffsets == offsets_alloc)
+	{
+	  offsets_alloc = offsets_alloc ? offsets_alloc * 2 : 64;
+	  struct ar_offset *new_offsets
+	    = realloc (offsets, offsets_alloc * sizeof (struct ar_offset));
+	  if (new_offsets == NULL)
+	    error (1, ENOMEM, "%s: Could not allocate memory", file);
+	  offsets = new_offsets;
+	  set_cleanup (offsets_cleanup, offsets, 0);
+	}
+      offsets[noffsets].old_off = aroff;
+      offsets[noffsets].new_off = outsize;
+      noffsets++;
+
+      char sizebuf[sizeof (hdr.ar_size) + 1];
+      if (snprintf (sizebuf, sizeof (sizebuf), "%-*zu",
+		    (int) sizeof (hdr.ar_size), size)
+	  != (int) sizeof (hdr.ar_size))
+	error (1, 0, "%s(%s): Member too big", file, arhdr->ar_name);
+      memcpy (hdr.ar_size, sizebuf, sizeof (hdr.ar_size));
+
+      pwrite_full (out, &hdr, sizeof (hdr), outsize, file);
+      outsize += sizeof (hdr);
+      pwrite_full (out, data, size, outsize, file);
+      outsize += size;
+      if (size % 2 != 0)
+	{
+	  pwrite_full (out, "\n", 1, outsize, file);
+	  outsize++;
+	}
+
+      if (map != NULL)
+	munmap (map, size);
+      if (mfd != -1)
+	close (mfd);
+      free (name);
+
+      cmd = elf_next (member);
+      drop_cleanups (member_mark);
+      if (elf_end (member) != 0)
+	error (1, 0, "%s: elf_end failed: %s", file, elf_errmsg (-1));
+    }
+
+  if (changed && symtab != NULL)
+    {
+      unsigned char *buf = malloc (symtab_size);
+      if (buf == NULL)
+	error (1, ENOMEM, "%s: Could not allocate memory", file);
+      size_t buf_mark = cleanups_mark ();
+      push_cleanup (cleanup_free, buf, 0);
+      memcpy (buf, symtab, symtab_size);
+      fixup_ar_symtab (buf, symtab_size, symtab64, offsets, noffsets,
+		       file);
+      pwrite_full (out, buf, symtab_size, symtab_off, file);
+      drop_cleanups (buf_mark);
+      free (buf);
+    }
+  free (offsets);
+  set_cleanup (offsets_cleanup, NULL, 0);
+
+  set_cleanup (ar_cleanup, NULL, 0);
+  if (elf_end (ar) != 0)
+    error (1, 0, "%s: elf_end failed: %s", file, elf_errmsg (-1));
+
+  if (changed)
+    {
+      /* Copy the new archive over the old one (keeping the inode, owner
+	 and permissions, just like for an ELF file).  */
+      void *map = mmap (NULL, outsize, PROT_READ, MAP_PRIVATE, out, 0);
+      if (map == MAP_FAILED)
+	error (1, errno, "Could not map new archive for '%s'", file);
+      size_t map_mark = cleanups_mark ();
+      push_cleanup (cleanup_munmap, map, outsize);
+      pwrite_full (fd, map, outsize, 0, file);
+      if (ftruncate (fd, outsize) != 0)
+	error (1, errno, "Could not truncate '%s'", file);
+      drop_cleanups (map_mark);
+      munmap (map, outsize);
+    }
+
+  drop_cleanups (mark);
+  close (out);
+
+  return changed;
+}
+
+/* Compressed files (like .ko.xz and .ko.zst kernel modules) holding
+   an ELF file that can be edited in memory.  */
+enum container
+{
+  CONTAINER_NONE,
+  CONTAINER_XZ,
+  CONTAINER_ZSTD
+};
+
+/* Size of the chunks streamed through the (de)compressors.  */
+#define CONTAINER_BUF_SIZE (64 * 1024)
+
+static enum container
+file_container (int fd)
+{
+  unsigned char magic[6];
+  ssize_t n = pread (fd, magic, sizeof (magic), 0);
+  if (n == 6 && memcmp (magic, "\xfd" "7zXZ\0", 6) == 0)
+    return CONTAINER_XZ;
+  if (n >= 4 && memcmp (magic, "\x28\xb5\x2f\xfd", 4) == 0)
+    return CONTAINER_ZSTD;
+  return CONTAINER_NONE;
+}
+
+/* The settings recorded in the container, used to compress the edited
+   file the same way again.  */
+struct container_settings
+{
+#ifdef HAVE_LZMA
+  lzma_check check;
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+#endif
+  bool checksum;
+};
+
+static void
+free_container_settings (void *ptr, size_t size __attribute__ ((unused)))
+{
+  struct container_settings *settings = ptr;
+#ifdef HAVE_LZMA
+  for (int i = 0; settings->filters[i].id != LZMA_VLI_UNKNOWN; i++)
+    free (settings->filters[i].options);
+#endif
+  free (settings);
+}
+
+#ifdef HAVE_LZMA
+/* Releases the lzma_stream PTR, allocated so it can be released when
+   unwinding from an error.  */
+static void
+free_lzma_stream (void *ptr, size_t size __attribute__ ((unused)))
+{
+  lzma_end (ptr);
+  free (ptr);
+}
+
+static lzma_stream *
+new_lzma_stream (const char *file)
+{
+  static const lzma_stream init = LZMA_STREAM_INIT;
+  lzma_stream *strm = malloc (sizeof (lzma_stream));
+  if (strm == NULL)
+    error (1, ENOMEM, "%s: Couldn't allocate xz stream", file);
+  *strm = init;
+  push_cleanup (free_lzma_stream, strm, 0);
+  return strm;
+}
+
+/* Decompresses the xz data IN of SIZE bytes into OUT.  Records the
+   integrity check of the stream and the filter chain of its first
+   block in SETTINGS.  Returns the decompressed size.  */
+static size_t
+xz_decompress (const unsigned char *in, size_t size, int out,
+	       struct container_settings *settings, const char *file)
+{
+  lzma_stream_flags flags;
+  if (size < LZMA_STREAM_HEADER_SIZE + 1
+      || lzma_stream_header_decode (&flags, in) != LZMA_OK)
+    error (1, 0, "%s: Bad xz stream header", file);
+
+  const unsigned char *hdr = in + LZMA_STREAM_HEADER_SIZE;
+  lzma_block block;
+  memset (&block, 0, sizeof (block));
+  block.check = flags.check;
+  block.filters = settings->filters;
+  block.header_size = lzma_block_header_size_decode (hdr[0]);
+  if (hdr[0] == 0
+      || block.header_size > size - LZMA_STREAM_HEADER_SIZE
+      || lzma_block_header_decode (&block, NULL, hdr) != LZMA_OK)
+    error (1, 0, "%s: Bad xz block header", file);
+  settings->check = flags.check;
+
+  size_t mark = cleanups_mark ();
+  lzma_stream *strm = new_lzma_stream (file);
+  if (lzma_stream_decoder (strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+    error (1, 0, "%s: Couldn't create xz decoder", file);
+
+  unsigned char buf[CONTAINER_BUF_SIZE];
+  size_t outsize = 0;
+  lzma_ret ret;
+  strm->next_in = in;
+  strm->avail_in = size;
+  do
+    {
+      strm->next_out = buf;
+      strm->avail_out = sizeof (buf);
+      ret = lzma_code (strm, LZMA_FINISH);
+      if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+	error (1, 0, "%s: xz decompression failed (%d)", file, ret);
+      pwrite_full (out, buf, sizeof (buf) - strm->avail_out, outsize, file);
+      outsize += sizeof (buf) - strm->avail_out;
+    }
+  while (ret != LZMA_STREAM_END);
+  drop_cleanups (mark);
+  free_lzma_stream (strm, 0);
+
+  return outsize;
+}
+
+/* Compresses the SIZE bytes at IN into OUT with the check and filters
+   recorded by xz_decompress.  Returns the compressed size.  */
+static size_t
+xz_compress (const unsigned char *in, size_t size, int out,
+	     struct container_settings *settings, const char *file)
+{
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+  lzma_options_lzma lzma2;
+  memcpy (filters, settings->filters, sizeof (filters));
+  for (int i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++)
+    if (filters[i].id == LZMA_FILTER_LZMA2)
+      {
+	/* Only the dictionary size is recorded in the block header,
+	   take the other options from the default preset.  */
+	const lzma_options_lzma *opts = filters[i].options;
+	if (lzma_lzma_preset (&lzma2, LZMA_PRESET_DEFAULT))
+	  error (1, 0, "%s: Couldn't get xz preset", file);
+	lzma2.dict_size = opts->dict_size;
+	filters[i].options = &lzma2;
+      }
+
+  size_t mark = cleanups_mark ();
+  lzma_stream *strm = new_lzma_stream (file);
+  if (lzma_stream_encoder (strm, filters, settings->check) != LZMA_OK)
+    error (1, 0, "%s: Couldn't create xz encoder", file);
+
+  unsigned char buf[CONTAINER_BUF_SIZE];
+  size_t outsize = 0;
+  lzma_ret ret;
+  strm->next_in = in;
+  strm->avail_in = size;
+  do
+    {
+      strm->next_out = buf;
+      strm->avail_out = sizeof (buf);
+      ret = lzma_code (strm, LZMA_FINISH);
+      if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+	error (1, 0, "%s: xz compression failed (%d)", file, ret);
+      pwrite_full (out, buf, sizeof (buf) - strm->avail_out, outsize, file);
+      outsize += sizeof (buf) - strm->avail_out;
+    }
+  while (ret != LZMA_STREAM_END);
+  drop_cleanups (mark);
+  free_lzma_stream (strm, 0);
+
+  return outsize;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static void
+free_zstd_dctx (void *dctx, size_t size __attribute__ ((unused)))
+{
+  ZSTD_freeDCtx (dctx);
+}
+
+static void
+free_zstd_cctx (void *cctx, size_t size __attribute__ ((unused)))
+{
+  ZSTD_freeCCtx (cctx);
+}
+
+/* Decompresses the zstd data IN of SIZE bytes into OUT.  Records
+   whether the (first) frame has a content checksum in SETTINGS.
+   Returns the decompressed size.  */
+static size_t
+zstd_decompress (const unsigned char *in, size_t size, int out,
+		 struct container_settings *settings, const char *file)
+{
+  /* The frame header descriptor follows the magic.  */
+  if (size < 5)
+    error (1, 0, "%s: Bad zstd frame header", file);
+  settings->checksum = (in[4] & 0x04) != 0;
+
+  ZSTD_DCtx *dctx = ZSTD_createDCtx ();
+  if (dctx == NULL)
+    error (1, ENOMEM, "%s: Couldn't create zstd context", file);
+  size_t mark = cleanups_mark ();
+  push_cleanup (free_zstd_dctx, dctx, 0);
+
+  unsigned char buf[CONTAINER_BUF_SIZE];
+  ZSTD_inBuffer input = { in, size, 0 };
+  size_t outsize = 0, ret;
+  for (;;)
+    {
+      ZSTD_outBuffer output = { buf, sizeof (buf), 0 };
+      ret = ZSTD_decompressStream (dctx, &output, &input);
+      if (ZSTD_isError (ret))
+	error (1, 0, "%s: zstd decompression failed: %s", file,
+	       ZSTD_getErrorName (ret));
+      pwrite_full (out, buf, output.pos, outsize, file);
+      outsize += output.pos;
+      if (input.pos == input.size && output.pos < output.size)
+	break;
+    }
+  if (ret != 0)
+    error (1, 0, "%s: Truncated zstd data", file);
+  drop_cleanups (mark);
+  ZSTD_freeDCtx (dctx);
+
+  return outsize;
+}
+
+/* Compresses the SIZE bytes at IN into OUT at the default level, with
+   a content checksum if the original had one.  Returns the compressed
+   size.  */
+static size_t
+zstd_compress (const unsigned char *in, size_t size, int out,
+	       struct container_settings *settings, const char *file)
+{
+  ZSTD_CCtx *cctx = ZSTD_createCCtx ();
+  if (cctx == NULL)
+    error (1, ENOMEM, "%s: Couldn't create zstd context", file);
+  size_t mark = cleanups_mark ();
+  push_cleanup (free_zstd_cctx, cctx, 0);
+  size_t ret = ZSTD_CCtx_setParameter (cctx, ZSTD_c_compressionLevel,
+				       ZSTD_CLEVEL_DEFAULT);
+  if (! ZSTD_isError (ret))
+    ret = ZSTD_CCtx_setParameter (cctx, ZSTD_c_checksumFlag,
+				  settings->checksum);
+  if (! ZSTD_isError (ret))
+    ret = ZSTD_CCtx_setPledgedSrcSize (cctx, size);
+  if (! ZSTD_isError (ret))
+    zstd_set_workers (cctx);
+  if (ZSTD_isError (ret))
+    error (1, 0, "%s: zstd compression failed: %s", file,
+	   ZSTD_getErrorName (ret));
+
+  unsigned char buf[CONTAINER_BUF_SIZE];
+  ZSTD_inBuffer input = { in, size, 0 };
+  size_t outsize = 0;
+  do
+    {
+      ZSTD_outBuffer output = { buf, sizeof (buf), 0 };
+      ret = ZSTD_compressStream2 (cctx, &output, &input, ZSTD_e_end);
+      if (ZSTD_isError (ret))
+	error (1, 0, "%s: zstd compression failed: %s", file,
+	       ZSTD_getErrorName (ret));
+      pwrite_full (out, buf, output.pos, outsize, file);
+      outsize += output.pos;
+    }
+  while (ret != 0);
+  drop_cleanups (mark);
+  ZSTD_freeCCtx (cctx);
+
+  return outsize;
+}
+#endif
+
+/* Decompresses the CONTAINER file open as FD, called FILE in messages,
+   into memory, edits the ELF file in it and, when that changed,
+   compresses it again in place with the same container format and
+   (as far as recorded in the file) the same settings.  Returns true if
+   FD was written to.  */
+static bool
+edit_container (int fd, const char *file, enum container container)
+{
+  struct stat st;
+  bool written = false;
+
+  size_t mark = cleanups_mark ();
+  struct container_settings *settings = calloc (1, sizeof (*settings));
+  if (settings == NULL)
+    error (1, ENOMEM, "%s: Could not allocate memory", file);
+#ifdef HAVE_LZMA
+  settings->filters[0].id = LZMA_VLI_UNKNOWN;
+#endif
+  push_cleanup (free_container_settings, settings, 0);
+
+  if (fstat (fd, &st) != 0)
+    error (1, errno, "Could not stat '%s'", file);
+  size_t size = st.st_size;
+  const unsigned char *in = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (in == MAP_FAILED)
+    error (1, errno, "Could not map '%s'", file);
+  size_t in_cleanup = push_cleanup (cleanup_munmap, (void *) in, size);
+
+  int elf_fd = open_anon_file (file);
+  push_cleanup (cleanup_close, NULL, elf_fd);
+  size_t elf_size;
+  switch (container)
+    {
+    case CONTAINER_XZ:
+#ifdef HAVE_LZMA
+      elf_size = xz_decompress (in, size, elf_fd, settings, file);
+      break;
+#else
+      error (1, 0, "%s: xz compressed files not supported", file);
+#endif
+    case CONTAINER_ZSTD:
+#ifdef HAVE_ZSTD
+      elf_size = zstd_decompress (in, size, elf_fd, settings, file);
+      break;
+#else
+      error (1, 0, "%s: zstd compressed files not supported", file);
+#endif
+    default:
+      abort ();
+    }
+  munmap ((void *) in, size);
+  set_cleanup (in_cleanup, NULL, 0);
+
+  if (edit_file (elf_fd, file))
+    {
+      if (fstat (elf_fd, &st) != 0)
+	error (1, errno, "Could not stat '%s'", file);
+      elf_size = st.st_size;
+      const unsigned char *elf = mmap (NULL, elf_size, PROT_READ,
+				       MAP_PRIVATE, elf_fd, 0);
+      if (elf == MAP_FAILED)
+	error (1, errno, "Could not map '%s'", file);
+      size_t elf_mark = cleanups_mark ();
+      push_cleanup (cleanup_munmap, (void *) elf, elf_size);
+
+      size_t new_size = 0;
+#ifdef HAVE_LZMA
+      if (container == CONTAINER_XZ)
+	new_size = xz_compress (elf, elf_size, fd, settings, file);
+#endif
+#ifdef HAVE_ZSTD
+      if (container == CONTAINER_ZSTD)
+	new_size = zstd_compress (elf, elf_size, fd, settings, file);
+#endif
+      if (ftruncate (fd, new_size) != 0)
+	error (1, errno, "Could not truncate '%s'", file);
+      drop_cleanups (elf_mark);
+      munmap ((void *) elf, elf_size);
+      written = true;
+    }
+
+  drop_cleanups (mark);
+  close (elf_fd);
+  free_container_settings (settings, 0);
+
+  return written;
+}
+
+
+_Static_assert (DEBUGEDIT_COMPRESS_ZLIB == ELFCOMPRESS_ZLIB
+		&& DEBUGEDIT_COMPRESS_ZSTD == ELFCOMPRESS_ZSTD,
+		"compress_type is used as ELFCOMPRESS type");
+
+/* Makes CTX the context of this thread, setting up the thread local
+   settings and state from it.  */
+static void
+load_context (struct debugedit *ctx)
+{
+  cur_ctx = ctx;
+
+  base_dir = ctx->base_dir;
+  dest_dir = ctx->dest_dir;
+  prefix_maps = ctx->prefix_trie;
+  list_file = ctx->list_file;
+  list_file_fd = ctx->list_file_fd;
+  list_index = ctx->list_index;
+  do_build_id = ctx->opts.build_id;
+  no_recompute_build_id = ctx->opts.no_recompute_build_id;
+  build_id_seed = ctx->build_id_seed;
+  build_id_tree = ctx->opts.build_id_tree;
+  compress_type = ctx->opts.compress_type;
+  compress_level = ctx->opts.compress_level;
+  compress_all = ctx->opts.compress_all;
+  jobs = ctx->opts.jobs;
+  memory_limit = ctx->opts.memory_limit;
+  build_id_only = (do_build_id && base_dir == NULL && prefix_maps == NULL
+		   && list_file == NULL && compress_type == -1);
+
+  source_files = ctx->source_files;
+  list_file_names = ctx->list_file_names;
+  list_file_buf = ctx->list_file_buf;
+  list_file_buf_len = ctx->list_file_buf_len;
+  list_index_fd = ctx->list_index_fd;
+  list_index_map = ctx->list_index_map;
+  list_index_map_size = ctx->list_index_map_size;
+}
+
+/* Puts the state that is kept from file to file back in the context
+   of this thread and forgets about it.  */
+static void
+save_context (void)
+{
+  struct debugedit *ctx = cur_ctx;
+
+  ctx->source_files = source_files;
+  ctx->list_file_names = list_file_names;
+  ctx->list_file_buf = list_file_buf;
+  ctx->list_file_buf_len = list_file_buf_len;
+  ctx->list_index_fd = list_index_fd;
+  ctx->list_index_map = list_index_map;
+  ctx->list_index_map_size = list_index_map_size;
+
+  source_files = NULL;
+  list_file_names = NULL;
+  list_file_buf = NULL;
+  list_index_map = NULL;
+  check_result = NULL;
+  cur_ctx = NULL;
+}
+
+void
+debugedit_options_init (struct debugedit_options *opts)
+{
+  memset (opts, 0, sizeof *opts);
+  opts->compress_type = DEBUGEDIT_COMPRESS_KEEP;
+  opts->compress_level = -1;
+  opts->jobs = 1;
+}
+
+/* Sets up MAP to replace the path OLD, of OLD_LEN bytes, by NEW.  Both
+   are copied and canonicalized.  */
+static void
+init_prefix_map (struct prefix_map *map, const char *old, size_t old_len,
+		 const char *new)
+{
+  size_t new_len = strlen (new);
+  map->old = malloc (old_len + 1 + new_len + 1);
+  if (map->old == NULL)
+    error (1, ENOMEM, "Couldn't copy options");
+  memcpy (map->old, old, old_len);
+  map->old[old_len] = '\0';
+  map->new = map->old + old_len + 1;
+  memcpy (map->new, new, new_len + 1);
+  canonicalize_path (map->old, map->old);
+  canonicalize_path (map->new, map->new);
+  map->new_len = strlen (map->new);
+}
+
+/* strdup S, if not NULL.  */
+static char *
+copy_option (const char *s)
+{
+  if (s == NULL)
+    return NULL;
+  char *c = strdup (s);
+  if (c == NULL)
+    error (1, ENOMEM, "Couldn't copy options");
+  return c;
+}
+
+debugedit *
+debugedit_begin (const struct debugedit_options *opts, char **errmsg)
+{
+  struct debugedit *ctx = calloc (1, sizeof *ctx);
+  *errmsg = NULL;
+  if (ctx == NULL)
+    return NULL;
+  ctx->opts = *opts;
+  ctx->list_file_fd = -1;
+  ctx->list_index_fd = -1;
+
+  cur_ctx = ctx;
+  if (setjmp (ctx->unwind) != 0)
+    {
+      run_cleanups (ctx);
+      cur_ctx = NULL;
+      *errmsg = ctx->errmsg;
+      ctx->errmsg = NULL;
+      debugedit_end (ctx);
+      return NULL;
+    }
+
+  if (opts->dest_dir != NULL && opts->base_dir == NULL)
+    error (1, 0, "You must specify a base dir if you specify a dest dir");
+
+  if (opts->list_index != NULL && opts->list_file == NULL)
+    error (1, 0, "--list-index needs --list-file (-l)");
+
+  if (opts->build_id_seed != NULL && ! opts->build_id)
+    error (1, 0, "--build-id-seed (-s) needs --build-id (-i)");
+
+  if (opts->build_id_tree && ! opts->build_id)
+    error (1, 0, "--build-id-mode=tree needs --build-id (-i)");
+
+  if (opts->build_id_seed != NULL && strlen (opts->build_id_seed) < 1)
+    error (1, 0, "--build-id-seed (-s) string should be at least 1 char");
+
+  if (opts->compress_type < DEBUGEDIT_COMPRESS_KEEP
+      || opts->compress_type > DEBUGEDIT_COMPRESS_ZSTD)
+    error (1, 0, "Unknown compression type %d", opts->compress_type);
+
+  if ((opts->compress_level != -1 || opts->compress_all)
+      && opts->compress_type == DEBUGEDIT_COMPRESS_KEEP)
+    error (1, 0, "--compress-level and --compress-all need "
+	   "--compress-debug-sections");
+
+  if (opts->compress_type > 0 && ! can_compress (opts->compress_type))
+    error (1, 0, "Compression type '%s' not supported%s",
+	   opts->compress_type == ELFCOMPRESS_ZSTD ? "zstd" : "zlib",
+	   opts->compress_level != -1 ? " with --compress-level" : "");
+
+  if (opts->jobs < 0)
+    error (1, 0, "Invalid number of jobs %d", opts->jobs);
+  if (opts->jobs == 0)
+    {
+      long n = sysconf (_SC_NPROCESSORS_ONLN);
+      ctx->opts.jobs = n < 1 ? 1 : MIN (n, INT_MAX);
+    }
+
+  if (elf_version (EV_CURRENT) == EV_NONE)
+    error (1, 0, "library out of date");
+
+  ctx->base_dir = copy_option (opts->base_dir);
+  ctx->dest_dir = copy_option (opts->dest_dir);
+  ctx->list_file = copy_option (opts->list_file);
+  ctx->list_index = copy_option (opts->list_index);
+  ctx->build_id_seed = copy_option (opts->build_id_seed);
+  ctx->cache_dir = copy_option (opts->cache_dir);
+  ctx->opts.base_dir = NULL;
+  ctx->opts.dest_dir = NULL;
+  ctx->opts.list_file = NULL;
+  ctx->opts.list_index = NULL;
+  ctx->opts.build_id_seed = NULL;
+  ctx->opts.cache_dir = NULL;
+
+  /* Ensure clean paths, users can muck with these. Also removes any
+     trailing '/' from the paths. */
+  if (ctx->base_dir)
+    canonicalize_path (ctx->base_dir, ctx->base_dir);
+  if (ctx->dest_dir)
+    canonicalize_path (ctx->dest_dir, ctx->dest_dir);
+
+  /* All paths to rewrite go in one trie, -b and -d first so an
+     identical --prefix-map overrides them.  */
+  size_t nmaps = opts->nprefix_maps + (ctx->dest_dir != NULL);
+  if (nmaps > 0)
+    {
+      ctx->prefix_maps = calloc (nmaps, sizeof (struct prefix_map));
+      ctx->prefix_trie = calloc (1, sizeof (struct prefix_node));
+      if (ctx->prefix_maps == NULL || ctx->prefix_trie == NULL)
+	error (1, ENOMEM, "Couldn't allocate prefix maps");
+      if (ctx->dest_dir != NULL)
+	init_prefix_map (&ctx->prefix_maps[ctx->nprefix_maps++],
+			 ctx->base_dir, strlen (ctx->base_dir),
+			 ctx->dest_dir);
+      for (size_t i = 0; i < opts->nprefix_maps; i++)
+	{
+	  const char *arg = opts->prefix_maps[i];
+	  const char *eq = strchr (arg, '=');
+	  if (eq == NULL || eq == arg)
+	    error (1, 0, "Invalid --prefix-map '%s', should be OLD=NEW",
+		   arg);
+	  init_prefix_map (&ctx->prefix_maps[ctx->nprefix_maps++],
+			   arg, eq - arg, eq + 1);
+	}
+      for (size_t i = 0; i < ctx->nprefix_maps; i++)
+	if (! add_prefix_map (ctx->prefix_trie, &ctx->prefix_maps[i]))
+	  error (1, ENOMEM, "Couldn't allocate prefix maps");
+    }
+  ctx->opts.prefix_maps = NULL;
+  ctx->opts.nprefix_maps = 0;
+
+  if (ctx->list_file != NULL)
+    ctx->list_file_fd = open (ctx->list_file, O_WRONLY|O_CREAT|O_APPEND,
+			      0644);
+
+  if (ctx->list_index != NULL)
+    {
+      ctx->list_index_fd = open (ctx->list_index, O_RDWR|O_CREAT, 0644);
+      if (ctx->list_index_fd < 0)
+	error (1, errno, "Failed to open list index '%s'", ctx->list_index);
+    }
+
+  cur_ctx = NULL;
+  return ctx;
+}
+
+/* With a cache_dir the result of each debugedit_edit call is kept in
+   a content addressed cache.  The key is a hash of the input file and
+   the settings that influence the result.  Each entry is a file
+   starting with a cache_header, followed by the build-ids and the list
+   file entries the edit produced.  Last, at file_offset, comes the
+   edited file, if it was written to.  On a hit the file contents are
+   copied (or reflinked) from the entry, without looking at any DWARF.
+   Entries are written to a temporary file first and then renamed, so
+   concurrent debugedit processes can share a cache_dir.  */
+#define CACHE_MAGIC "DEBUGEDC"
+#define CACHE_VERSION 2
+#define CACHE_ALIGN 4096
+
+struct cache_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t written;
+  /* Followed by nbuild_ids uint64_t end offsets of the build-ids, the
+     build-ids themselves and the list file entries.  */
+  uint64_t nbuild_ids;
+  uint64_t build_ids_size;
+  uint64_t list_size;
+  uint64_t file_offset;
+  uint64_t file_size;
+};
+
+/* Adds the list file entry NAME (LEN bytes), followed by a '/' if
+   SLASH is true, to the list file entries captured for the cache.  */
+static void
+capture_list_entry (const char *name, size_t len, bool slash)
+{
+  struct debugedit *ctx = cur_ctx;
+  size_t size = len + slash + 1;
+  if (ctx->list_capture_len + size > ctx->list_capture_size)
+    {
+      size_t n = MAX (2 * ctx->list_capture_size,
+		      ctx->list_capture_len + size);
+      char *buf = realloc (ctx->list_capture, n);
+      if (buf == NULL)
+	error (1, ENOMEM, "Could not write to '%s'", list_file);
+      ctx->list_capture = buf;
+      ctx->list_capture_size = n;
+    }
+  char *entry = ctx->list_capture + ctx->list_capture_len;
+  memcpy (entry, name, len);
+  if (slash)
+    entry[len] = '/';
+  entry[size - 1] = '\0';
+  ctx->list_capture_len += size;
+}
+
+/* Start capturing the list file entries of the file about to be
+   edited.  The sources seen in earlier files are put aside, so all
+   names of this file go through list_file_add.  */
+static void
+start_list_capture (struct debugedit *ctx)
+{
+  ctx->capturing = true;
+  ctx->list_capture_len = 0;
+  ctx->saved_source_files = source_files;
+  source_files = NULL;
+}
+
+static void
+end_list_capture (struct debugedit *ctx)
+{
+  if (! ctx->capturing)
+    return;
+  if (source_files != NULL)
+    htab_delete (source_files);
+  source_files = ctx->saved_source_files;
+  ctx->saved_source_files = NULL;
+  ctx->capturing = false;
+}
+
+/* Adds the setting string S, which might be NULL, to STATE.  */
+static void
+cache_key_string (XXH3_state_t *state, const char *s)
+{
+  XXH3_128bits_update (state, s != NULL ? "1" : "0", 1);
+  if (s != NULL)
+    XXH3_128bits_update (state, s, strlen (s) + 1);
+}
+
+/* The cache key for the contents of FILE, open as FD, edited with the
+   current settings.  */
+static XXH128_hash_t
+cache_key (int fd, const char *file)
+{
+  XXH3_state_t *state = XXH3_createState ();
+  if (state == NULL)
+    error (1, ENOMEM, "Failed to create xxhash state");
+  size_t mark = cleanups_mark ();
+  push_cleanup (cleanup_xxh3_state, state, 0);
+  XXH3_128bits_reset (state);
+
+  int settings[] = { CACHE_VERSION, list_file != NULL, do_build_id,
+		     no_recompute_build_id, build_id_tree, compress_type,
+		     compress_level, compress_all };
+  cache_key_string (state, VERSION);
+  XXH3_128bits_update (state, settings, sizeof settings);
+  cache_key_string (state, base_dir);
+  for (size_t i = 0; i < cur_ctx->nprefix_maps; i++)
+    {
+      cache_key_string (state, cur_ctx->prefix_maps[i].old);
+      cache_key_string (state, cur_ctx->prefix_maps[i].new);
+    }
+  cache_key_string (state, build_id_seed);
+
+  struct stat st;
+  if (fstat (fd, &st) != 0)
+    error (1, errno, "Could not stat '%s'", file);
+  if (st.st_size > 0)
+    {
+      void *map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED)
+	error (1, errno, "Could not map '%s'", file);
+      XXH3_128bits_update (state, map, st.st_size);
+      munmap (map, st.st_size);
+    }
+
+  XXH128_hash_t key = XXH3_128bits_digest (state);
+  drop_cleanups (mark);
+  XXH3_freeState (state);
+  return key;
+}
+
+/* The path of the cache entry for KEY.  */
+static char *
+cache_path (struct debugedit *ctx, XXH128_hash_t key)
+{
+  char *path;
+  if (asprintf (&path, "%s/%016" PRIx64 "%016" PRIx64, ctx->cache_dir,
+		(uint64_t) key.high64, (uint64_t) key.low64) < 0)
+    error (1, ENOMEM, "Couldn't create cache entry name");
+  return path;
+}
+
+/* Copies SIZE bytes at IN_OFF in file IN to OUT_OFF in file OUT.
+   Returns false on failure, with errno set.  */
+static bool
+copy_file_data (int in, off_t in_off, int out, off_t out_off, size_t size)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+  /* This shares the data blocks on file systems that can.  */
+  while (size > 0)
+    {
+      ssize_t n = copy_file_range (in, &in_off, out, &out_off, size, 0);
+      if (n <= 0)
+	break;
+      size -= n;
+    }
+#endif
+  char buf[64 * 1024];
+  while (size > 0)
+    {
+      ssize_t n = pread (in, buf, MIN (size, sizeof buf), in_off);
+      if (n <= 0)
+	{
+	  if (n == 0)
+	    errno = EIO;
+	  return false;
+	}
+      if (pwrite (out, buf, n, out_off) != n)
+	return false;
+      in_off += n;
+      out_off += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Reads exactly SIZE bytes at OFF in FD into BUF.  */
+static bool
+pread_all (int fd, void *buf, size_t size, off_t off)
+{
+  char *p = buf;
+  while (size > 0)
+    {
+      ssize_t n = pread (fd, p, size, off);
+      if (n <= 0)
+	return false;
+      p += n;
+      off += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Writes the SIZE bytes at BUF at OFF in FD.  */
+static bool
+pwrite_all (int fd, const void *buf, size_t size, off_t off)
+{
+  const char *p = buf;
+  while (size > 0)
+    {
+      ssize_t n = pwrite (fd, p, size, off);
+      if (n <= 0)
+	return false;
+      p += n;
+      off += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Looks up the cache entry for KEY.  On a hit, restores the edited
+   FILE open as FD, the build-ids and list file entries, sets *WRITTEN
+   and returns true.  */
+static bool
+cache_lookup (struct debugedit *ctx, XXH128_hash_t key, int fd,
+	      const char *file, bool *written)
+{
+  char *path = cache_path (ctx, key);
+  int cfd = open (path, O_RDONLY | O_CLOEXEC);
+  free (path);
+  if (cfd < 0)
+    return false;
+  size_t mark = cleanups_mark ();
+  push_cleanup (cleanup_close, NULL, cfd);
+
+  struct cache_header hdr;
+  struct stat st;
+  uint64_t *ends = NULL;
+  unsigned char *ids = NULL;
+  char *list = NULL;
+  bool hit = false;
+  if (fstat (cfd, &st) != 0
+      || ! pread_all (cfd, &hdr, sizeof hdr, 0)
+      || memcmp (hdr.magic, CACHE_MAGIC, sizeof hdr.magic) != 0
+      || hdr.version != CACHE_VERSION
+      || hdr.nbuild_ids > (uint64_t) st.st_size / sizeof (uint64_t)
+      || hdr.build_ids_size > (uint64_t) st.st_size
+      || hdr.list_size > (uint64_t) st.st_size
+      || hdr.file_offset > (uint64_t) st.st_size
+      || hdr.file_size != (uint64_t) st.st_size - hdr.file_offset)
+    goto out;
+
+  size_t ends_size = hdr.nbuild_ids * sizeof (uint64_t);
+  ends = malloc (ends_size + 1);
+  ids = malloc (hdr.build_ids_size + 1);
+  list = malloc (hdr.list_size + 1);
+  push_cleanup (cleanup_free, ends, 0);
+  push_cleanup (cleanup_free, ids, 0);
+  push_cleanup (cleanup_free, list, 0);
+  if (ends == NULL || ids == NULL || list == NULL)
+    goto out;
+  off_t off = sizeof hdr;
+  if (! pread_all (cfd, ends, ends_size, off)
+      || ! pread_all (cfd, ids, hdr.build_ids_size, off + ends_size)
+      || ! pread_all (cfd, list, hdr.list_size,
+		       off + ends_size + hdr.build_ids_size)
+      || (hdr.list_size > 0 && list[hdr.list_size - 1] != '\0'))
+    goto out;
+  for (uint64_t i = 0; i < hdr.nbuild_ids; i++)
+    if (ends[i] > hdr.build_ids_size || (i > 0 && ends[i] < ends[i - 1]))
+      goto out;
+
+  if (hdr.written)
+    {
+      if (ftruncate (fd, hdr.file_size) != 0
+	  || ! copy_file_data (cfd, hdr.file_offset, fd, 0, hdr.file_size))
+	error (1, errno, "Failed to restore '%s' from cache", file);
+    }
+  *written = hdr.written;
+
+  for (uint64_t i = 0; i < hdr.nbuild_ids; i++)
+    {
+      size_t start = i == 0 ? 0 : ends[i - 1];
+      record_build_id (ids + start, ends[i] - start);
+    }
+  if (list_file_fd != -1)
+    {
+      for (size_t i = 0; i < hdr.list_size; i += strlen (list + i) + 1)
+	list_file_add (list + i, false);
+      list_file_flush ();
+    }
+  hit = true;
+
+ out:
+  drop_cleanups (mark);
+  free (ends);
+  free (ids);
+  free (list);
+  close (cfd);
+  return hit;
+}
+
+/* Stores the result of editing FILE, open as FD, in the cache entry
+   for KEY.  Failing to do so only warrants a warning.  */
+static void
+cache_store (struct debugedit *ctx, XXH128_hash_t key, int fd,
+	     const char *file, bool written)
+{
+  if (mkdir (ctx->cache_dir, 0777) != 0 && errno != EEXIST)
+    {
+      error (0, errno, "Couldn't create cache dir '%s'", ctx->cache_dir);
+      return;
+    }
+
+  char *tmp;
+  if (asprintf (&tmp, "%s/tmp.XXXXXX", ctx->cache_dir) < 0)
+    error (1, ENOMEM, "Couldn't create cache entry name");
+  int cfd = mkstemp (tmp);
+  if (cfd < 0)
+    {
+      error (0, errno, "Couldn't create cache entry '%s'", tmp);
+      free (tmp);
+      return;
+    }
+  size_t mark = cleanups_mark ();
+  push_cleanup (cleanup_unlink, tmp, 0);
+  push_cleanup (cleanup_close, NULL, cfd);
+
+  struct cache_header hdr;
+  memset (&hdr, 0, sizeof hdr);
+  memcpy (hdr.magic, CACHE_MAGIC, sizeof hdr.magic);
+  hdr.version = CACHE_VERSION;
+  hdr.written = written;
+  hdr.nbuild_ids = ctx->nbuild_ids;
+  hdr.build_ids_size = (ctx->nbuild_ids == 0
+			? 0 : ctx->build_id_ends[ctx->nbuild_ids - 1]);
+  hdr.list_size = ctx->capturing ? ctx->list_capture_len : 0;
+  size_t ends_size = hdr.nbuild_ids * sizeof (uint64_t);
+  off_t off = sizeof hdr + ends_size + hdr.build_ids_size + hdr.list_size;
+  hdr.file_offset = (off + CACHE_ALIGN - 1) & ~(off_t) (CACHE_ALIGN - 1);
+
+  struct stat st;
+  bool ok = true;
+  if (written)
+    {
+      ok = fstat (fd, &st) == 0;
+      hdr.file_size = ok ? st.st_size : 0;
+    }
+
+  uint64_t *ends = malloc (ends_size + 1);
+  ok = ok && ends != NULL;
+  for (size_t i = 0; ok && i < ctx->nbuild_ids; i++)
+    ends[i] = ctx->build_id_ends[i];
+  off = sizeof hdr;
+  ok = (ok
+	&& pwrite_all (cfd, &hdr, sizeof hdr, 0)
+	&& pwrite_all (cfd, ends, ends_size, off)
+	&& pwrite_all (cfd, ctx->build_ids, hdr.build_ids_size,
+		       off + ends_size)
+	&& pwrite_all (cfd, ctx->list_capture, hdr.list_size,
+		       off + ends_size + hdr.build_ids_size)
+	&& ftruncate (cfd, hdr.file_offset) == 0
+	&& copy_file_data (fd, 0, cfd, hdr.file_offset, hdr.file_size));
+  free (ends);
+
+  char *path = cache_path (ctx, key);
+  drop_cleanups (mark);
+  if (close (cfd) != 0 || ! ok || rename (tmp, path) != 0)
+    {
+      error (0, errno, "Couldn't write cache entry for '%s'", file);
+      unlink (tmp);
+    }
+  free (path);
+  free (tmp);
+}
+
+/* With the atomic option FILE isn't edited in place.  A copy is edited
+   in a new file in the same directory, which then replaces FILE with
+   rename, so FILE is always either the old or the completely edited
+   file.  The copy shares the data blocks with FILE on file systems
+   that can (see copy_file_data), so only the edited regions are really
+   written.  The new file is an O_TMPFILE when possible, which doesn't
+   leave anything behind when debugedit dies before it is done.  It
+   gets the owner, mode and extended attributes (SELinux label, file
+   capabilities, ACLs) of FILE.  */
+
+/* Returns a mkstemp template for a new file next to PATH.  */
+static char *
+atomic_template (const char *path)
+{
+  const char *base = strrchr (path, '/') + 1;
+  char *tmpl;
+  if (asprintf (&tmpl, "%.*s.%s.XXXXXX", (int) (base - path), path,
+		base) < 0)
+    error (1, ENOMEM, "Could not create temporary file for '%s'", path);
+  return tmpl;
+}
+
+/* Returns a new file in the directory of PATH, which must be absolute,
+   to edit a copy of PATH in.  Sets *TMPNAME to its malloced name, or
+   to NULL if it is an O_TMPFILE without a name.  */
+static int
+open_atomic (const char *path, char **tmpname)
+{
+  *tmpname = NULL;
+#ifdef O_TMPFILE
+  /* Linking an O_TMPFILE in place goes through /proc.  */
+  if (access ("/proc/self/fd", F_OK) == 0)
+    {
+      const char *slash = strrchr (path, '/');
+      char *dir = strndup (path, slash == path ? 1 : slash - path);
+      if (dir == NULL)
+	error (1, ENOMEM, "Could not create temporary file for '%s'", path);
+      int fd = open (dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+      free (dir);
+      if (fd >= 0)
+	return fd;
+    }
+#endif
+
+  char *tmpl = atomic_template (path);
+  int fd = mkstemp (tmpl);
+  if (fd < 0)
+    {
+      int err = errno;
+      free (tmpl);
+      error (1, err, "Could not create temporary file for '%s'", path);
+    }
+  *tmpname = tmpl;
+  return fd;
+}
+
+/* Returns the extended attributes of PATH, open as FD, in a malloced
+   buffer for write_xattrs and sets *SIZE to its size.  Each attribute
+   is its value size as size_t, its zero terminated name and its value.
+   Returns NULL if there are none, or with a warning if they cannot be
+   read.  */
+static char *
+read_xattrs (int fd, const char *path, size_t *size)
+{
+  *size = 0;
+#ifdef HAVE_SYS_XATTR_H
+  ssize_t names_size = flistxattr (fd, NULL, 0);
+  if (names_size <= 0)
+    {
+      if (names_size < 0 && errno != ENOTSUP)
+	error (0, errno, "Could not read the extended attributes of '%s'",
+	       path);
+      return NULL;
+    }
+
+  char *names = malloc (names_size);
+  names_size = names == NULL ? -1 : flistxattr (fd, names, names_size);
+  size_t buf_size = 0;
+  for (ssize_t i = 0; i < names_size; i += strlen (names + i) + 1)
+    {
+      ssize_t n = fgetxattr (fd, names + i, NULL, 0);
+      if (n < 0)
+	goto fail;
+      buf_size += sizeof (size_t) + strlen (names + i) + 1 + n;
+    }
+  char *buf = names_size < 0 ? NULL : malloc (buf_size);
+  if (buf == NULL)
+    goto fail;
+
+  size_t off = 0;
+  for (ssize_t i = 0; i < names_size; i += strlen (names + i) + 1)
+    {
+      size_t name_len = strlen (names + i) + 1;
+      char *value = buf + off + sizeof (size_t) + name_len;
+      ssize_t n = fgetxattr (fd, names + i, value,
+			     buf_size - (value - buf));
+      if (n < 0)
+	{
+	  free (buf);
+	  goto fail;
+	}
+      size_t value_size = n;
+      memcpy (buf + off, &value_size, sizeof (size_t));
+      memcpy (buf + off + sizeof (size_t), names + i, name_len);
+      off += sizeof (size_t) + name_len + n;
+    }
+  free (names);
+  *size = off;
+  return buf;
+
+ fail:
+  error (0, errno, "Could not read the extended attributes of '%s'", path);
+  free (names);
+#else
+  (void) fd;
+  (void) path;
+#endif
+  return NULL;
+}
+
+/* Sets the SIZE bytes of extended attributes BUF from read_xattrs on
+   FD, the new PATH.  Those already the same (like an SELinux label that
+   the new file got anyway) are left alone.  */
+static void
+write_xattrs (int fd, const char *buf, size_t size, const char *path)
+{
+#ifdef HAVE_SYS_XATTR_H
+  for (size_t off = 0; off < size; )
+    {
+      size_t value_size;
+      memcpy (&value_size, buf + off, sizeof (size_t));
+      const char *name = buf + off + sizeof (size_t);
+      const char *value = name + strlen (name) + 1;
+      off = value + value_size - buf;
+
+      char cur[256];
+      if (value_size <= sizeof cur
+	  && fgetxattr (fd, name, cur, sizeof cur) == (ssize_t) value_size
+	  && memcmp (cur, value, value_size) == 0)
+	continue;
+      if (fsetxattr (fd, name, value, value_size, 0) != 0)
+	error (0, errno, "Could not keep extended attribute %s of '%s'",
+	       name, path);
+    }
+#else
+  (void) fd;
+  (void) buf;
+  (void) size;
+  (void) path;
+#endif
+}
+
+/* Puts the edited copy of PATH in FD, called TMPNAME or an O_TMPFILE
+   if that is NULL, in place of PATH with the mode and owner in ST and
+   the SIZE bytes of extended attributes XATTRS from read_xattrs.  */
+static void
+commit_atomic (int fd, const char *tmpname, const char *path,
+	       const struct stat *st, const char *xattrs, size_t size)
+{
+  /* Never replace a file by one with another owner, that would let
+     whoever can write the directory take over someone else's file.
+     Leave PATH alone instead.  */
+  struct stat new_st;
+  if (fstat (fd, &new_st) != 0)
+    error (1, errno, "Could not stat the new '%s'", path);
+  if ((new_st.st_uid != st->st_uid || new_st.st_gid != st->st_gid)
+      && fchown (fd, st->st_uid, st->st_gid) != 0)
+    error (1, errno, "Could not keep the owner of '%s'", path);
+  /* After the data is written and the owner changed, which would both
+     drop file capabilities.  */
+  write_xattrs (fd, xattrs, size, path);
+  if (fchmod (fd, st->st_mode & 07777) != 0)
+    error (1, errno, "Could not set the mode of the new '%s'", path);
+
+  char *name = NULL;
+  if (tmpname == NULL)
+    {
+      /* linkat cannot replace PATH, so link to a new name first.  */
+      char proc[32];
+      snprintf (proc, sizeof proc, "/proc/self/fd/%d", fd);
+      for (int tries = 0; name == NULL; tries++)
+	{
+	  name = atomic_template (path);
+	  int tfd = mkstemp (name);
+	  if (tfd >= 0)
+	    {
+	      close (tfd);
+	      unlink (name);
+	      if (linkat (AT_FDCWD, proc, AT_FDCWD, name,
+			  AT_SYMLINK_FOLLOW) == 0)
+		break;
+	    }
+	  int err = errno;
+	  free (name);
+	  name = NULL;
+	  if (err != EEXIST || tries == 10)
+	    error (1, err, "Could not link the new '%s'", path);
+	}
+      tmpname = name;
+    }
+
+  if (rename (tmpname, path) != 0)
+    {
+      int err = errno;
+      if (name != NULL)
+	{
+	  unlink (name);
+	  free (name);
+	}
+      error (1, err, "Could not replace '%s'", path);
+    }
+  free (name);
+}
+
+/* Does the work of debugedit_edit, or of debugedit_check putting the
+   result in CHECK when not NULL.  */
+static int
+edit_or_check (debugedit *ctx, const char *file,
+	       struct debugedit_check *check)
+{
+  struct stat stat_buf;
+  /* Set after setjmp, so volatile.  */
+  volatile int fd = -1;
+  volatile bool restore_mode = false;
+  volatile mode_t mode = 0;
+  /* The real FILE and the name of the new file with the atomic
+     option.  */
+  char *volatile path = NULL;
+  char *volatile tmpname = NULL;
+  /* The extended attributes of FILE with the atomic option.  */
+  char *volatile xattrs = NULL;
+  size_t xattrs_size = 0;
+  bool written;
+
+  free (ctx->errmsg);
+  ctx->errmsg = NULL;
+  ctx->nbuild_ids = 0;
+
+  load_context (ctx);
+  if (check != NULL)
+    {
+      memset (check, 0, sizeof *check);
+      check_result = check;
+      /* Nothing is written, not even the list file.  */
+      list_file_fd = -1;
+      build_id_only = false;
+    }
+  if (setjmp (ctx->unwind) != 0)
+    {
+      if (ctx->dso != NULL)
+	{
+	  elf_end (ctx->dso->elf);
+	  free_dso (ctx->dso);
+	  ctx->dso = NULL;
+	}
+      if (ctx->elf != NULL)
+	{
+	  elf_end (ctx->elf);
+	  ctx->elf = NULL;
+	}
+      run_cleanups (ctx);
+      reset_debug_sections ();
+      end_list_capture (ctx);
+      if (fd != -1)
+	close (fd);
+      if (restore_mode)
+	chmod (file, mode);
+      if (tmpname != NULL)
+	unlink (tmpname);
+      free (tmpname);
+      free (path);
+      free (xattrs);
+      save_context ();
+      return -1;
+    }
+
+  if (stat (file, &stat_buf) < 0)
+    error (1, errno, "Failed to open input file '%s'", file);
+  mode = stat_buf.st_mode;
+
+  bool read_only = (check != NULL
+		    || (prefix_maps == NULL
+			&& (!do_build_id || no_recompute_build_id)
+			&& compress_type == -1));
+  bool atomic = ! read_only && ctx->opts.atomic;
+  if (memory_limit != 0 && ! read_only && ! ctx->memory_limit_warned)
+    {
+      ctx->memory_limit_warned = true;
+      error (0, 0, "--memory-limit only bounds reading, files that are "
+	     "edited still need all their debug sections in memory");
+    }
+  if (atomic)
+    {
+      /* Replace the file a symlink points to, not the symlink.  */
+      path = realpath (file, NULL);
+      if (path == NULL)
+	error (1, errno, "Failed to open input file '%s'", file);
+      char *name;
+      fd = open_atomic (path, &name);
+      tmpname = name;
+
+      /* Make sure we can read, like when editing in place.  */
+      if ((stat_buf.st_mode & S_IRUSR) == 0)
+	{
+	  if (chmod (path, stat_buf.st_mode | S_IRUSR) != 0)
+	    error (0, errno, "Failed to chmod input file '%s' to make sure we can read", file);
+	  else
+	    restore_mode = true;
+	}
+      int in = open (path, O_RDONLY);
+      if (in < 0)
+	error (1, errno, "Failed to open input file '%s'", file);
+      xattrs = read_xattrs (in, file, &xattrs_size);
+      bool copied = copy_file_data (in, 0, fd, 0, stat_buf.st_size);
+      int err = errno;
+      close (in);
+      if (restore_mode)
+	{
+	  restore_mode = false;
+	  if (chmod (path, stat_buf.st_mode) != 0)
+	    error (0, errno, "Failed to chmod input file '%s' to restore old access rights", file);
+	}
+      if (! copied)
+	error (1, err, "Could not copy '%s'", file);
+    }
+  else
+    {
+      /* Make sure we can read and write, checking only reads.  */
+      if (check == NULL)
+	{
+	  if (chmod (file, stat_buf.st_mode | S_IRUSR | S_IWUSR) != 0)
+	    error (0, errno, "Failed to chmod input file '%s' to make sure we can read and write", file);
+	  else
+	    restore_mode = true;
+	}
+
+      if (read_only)
+	fd = open (file, O_RDONLY);
+      else
+	fd = open (file, O_RDWR);
+      if (fd < 0)
+	error (1, errno, "Failed to open input file '%s'", file);
+    }
+
+  XXH128_hash_t key = { 0, 0 };
+  bool cached = false;
+  if (ctx->cache_dir != NULL && check == NULL)
+    {
+      key = cache_key (fd, file);
+      cached = cache_lookup (ctx, key, fd, file, &written);
+      if (! cached && list_file != NULL)
+	start_list_capture (ctx);
+    }
+
+  if (! cached)
+    {
+      enum container container = file_container (fd);
+      if (container != CONTAINER_NONE)
+	written = edit_container (fd, file, container);
+      else if (is_archive (fd))
+	written = edit_archive (fd, file);
+      else
+	written = edit_file (fd, file);
+
+      if (ctx->cache_dir != NULL && check == NULL)
+	cache_store (ctx, key, fd, file, written);
+      end_list_capture (ctx);
+    }
+
+  if (atomic)
+    {
+      /* An unchanged copy just goes away.  */
+      if (written)
+	commit_atomic (fd, tmpname, path, &stat_buf, xattrs, xattrs_size);
+      else if (tmpname != NULL)
+	unlink (tmpname);
+      free (tmpname);
+      tmpname = NULL;
+      free (path);
+      path = NULL;
+      free (xattrs);
+      xattrs = NULL;
+    }
+  close (fd);
+  fd = -1;
+
+  /* Restore old access rights */
+  restore_mode = false;
+  if (check == NULL && ! atomic && chmod (file, stat_buf.st_mode) != 0)
+    error (0, errno, "Failed to chmod input file '%s' to restore old access rights", file);
+
+  save_context ();
+  if (check != NULL)
+    return check->needs != 0 ? 1 : 0;
+  return written ? 1 : 0;
+}
+
+int
+debugedit_edit (debugedit *ctx, const char *file)
+{
+  return edit_or_check (ctx, file, NULL);
+}
+
+int
+debugedit_check (debugedit *ctx, const char *file,
+		 struct debugedit_check *check)
+{
+  return edit_or_check (ctx, file, check);
+}
+
+const unsigned char *
+debugedit_build_id (debugedit *ctx, size_t n, size_t *size)
+{
+  if (n >= ctx->nbuild_ids)
+    return NULL;
+  size_t start = n == 0 ? 0 : ctx->build_id_ends[n - 1];
+  *size = ctx->build_id_ends[n] - start;
+  return ctx->build_ids + start;
+}
+
+const char *
+debugedit_errmsg (debugedit *ctx)
+{
+  return ctx->errmsg ?: "Out of memory";
+}
+
+void
+debugedit_end (debugedit *ctx)
+{
+  if (ctx->source_files != NULL)
+    htab_delete (ctx->source_files);
+  if (ctx->list_file_names != NULL)
+    htab_delete (ctx->list_file_names);
+  free (ctx->list_file_buf);
+  if (ctx->list_index_map != NULL)
+    munmap (ctx->list_index_map, ctx->list_index_map_size);
+  if (ctx->list_index_fd != -1)
+    close (ctx->list_index_fd);
+  if (ctx->list_file_fd != -1)
+    close (ctx->list_file_fd);
+
+  free (ctx->base_dir);
+  free (ctx->dest_dir);
+  for (size_t i = 0; i < ctx->nprefix_maps; i++)
+    free (ctx->prefix_maps[i].old);
+  free (ctx->prefix_maps);
+  free_prefix_trie (ctx->prefix_trie);
+  free (ctx->list_file);
+  free (ctx->list_index);
+  free (ctx->build_id_seed);
+  free (ctx->cache_dir);
+  free (ctx->list_capture);
+  free (ctx->build_ids);
+  free (ctx->build_id_ends);
+  free (ctx->cleanups);
+  free (ctx->errmsg);
+  free (ctx);
+}
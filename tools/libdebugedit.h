@@ -0,0 +1,167 @@
+/* Interface to edit the debuginfo of ELF files in process.
+   Copyright (C) 2024 Mark J. Wielaard <mark@klomp.org>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.  */
+
+#ifndef LIBDEBUGEDIT_H
+#define LIBDEBUGEDIT_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Everything the debugedit program does is available through a
+   debugedit context.  debugedit_begin creates one with the settings
+   to use, after which any number of files can be edited with
+   debugedit_edit, and debugedit_end releases it.  Errors are
+   returned, not reported on stderr, and never exit the process.
+
+   A context can only be used by one thread at a time, but different
+   contexts can be used at the same time by different threads.  */
+typedef struct debugedit debugedit;
+
+/* Values for debugedit_options compress_type.  */
+#define DEBUGEDIT_COMPRESS_KEEP (-1)
+#define DEBUGEDIT_COMPRESS_NONE 0
+#define DEBUGEDIT_COMPRESS_ZLIB 1
+#define DEBUGEDIT_COMPRESS_ZSTD 2
+
+/* The settings of a context, the debugedit option each corresponds to
+   is given between brackets.  Set up with debugedit_options_init.  */
+struct debugedit_options
+{
+  /* Base build directory of the objects (-b).  */
+  const char *base_dir;
+  /* Directory to rewrite base_dir into (-d), needs base_dir.  */
+  const char *dest_dir;
+  /* More paths to rewrite, NPREFIX_MAPS strings OLD=NEW each replacing
+     the directory OLD by NEW (--prefix-map).  When several match a
+     path the longest OLD is used.  */
+  const char *const *prefix_maps;
+  size_t nprefix_maps;
+  /* File to append the source and header file names to (-l).  */
+  const char *list_file;
+  /* Only add names to the list file not yet recorded in this index
+     file (--list-index), needs list_file.  */
+  const char *list_index;
+  /* Recompute the build ID note (-i).  */
+  bool build_id;
+  /* Use this string as build ID hash seed (-s), needs build_id.  */
+  const char *build_id_seed;
+  /* Do not recompute the build ID note, only get it (-n).  */
+  bool no_recompute_build_id;
+  /* Hash the build ID as a tree of section chunks
+     (--build-id-mode=tree), needs build_id.  */
+  bool build_id_tree;
+  /* Write the debug sections compressed with DEBUGEDIT_COMPRESS_ZLIB
+     or DEBUGEDIT_COMPRESS_ZSTD, or uncompressed with
+     DEBUGEDIT_COMPRESS_NONE (--compress-debug-sections).  The default,
+     DEBUGEDIT_COMPRESS_KEEP, keeps the compression of each section.  */
+  int compress_type;
+  /* Compression level, -1 for the default (--compress-level).  */
+  int compress_level;
+  /* Also compress sections that were not compressed (--compress-all).  */
+  bool compress_all;
+  /* Maximum number of threads to use, 0 means the number of online
+     processors (-j).  The default is 1.  Threads are only used for
+     computing the build ID and for compression, the DWARF data, like
+     the units of a .dwp file, is always processed serially.  */
+  int jobs;
+  /* Try to stay within this many bytes while reading the DWARF data
+     of big inputs, 0 (the default) means no limit (--memory-limit).
+     This only bounds files that are not written, like when only
+     listing their sources or with debugedit_check.  Rewriting paths,
+     the build ID or the compression of a file still needs all its
+     debug sections in memory, a warning is given the first time.  */
+  size_t memory_limit;
+  /* Directory to keep the results in, so editing identical files
+     with the same settings again only copies the result (--cache-dir).
+     Created when it doesn't exist.  */
+  const char *cache_dir;
+  /* Don't edit files in place, but edit a copy and rename it over the
+     file, so it is never left partially edited (--atomic).  The copy
+     shares the unchanged data blocks with the file on file systems
+     that support that.  The copy gets the owner, mode and extended
+     attributes (SELinux label, capabilities, ACLs) of the file, but
+     hard links to the file keep the old version.  When the owner
+     cannot be kept, like for a file owned by someone else, editing
+     fails and the file stays as it was.  */
+  bool atomic;
+  /* Called with each warning, if not NULL.  */
+  void (*warn) (const char *msg, void *arg);
+  void *warn_arg;
+};
+
+/* Sets OPTS to the defaults, nothing but listing the build ID.  */
+extern void debugedit_options_init (struct debugedit_options *opts);
+
+/* Creates a new context using OPTS, the strings are copied.  Returns
+   NULL on error, with *ERRMSG set to a malloced error message (or NULL
+   when out of memory).  */
+extern debugedit *debugedit_begin (const struct debugedit_options *opts,
+				   char **errmsg);
+
+/* Edits FILE, an ELF file, an ar archive of ELF files or an xz or zstd
+   compressed ELF file, in place.  Returns 1 if FILE was written to, 0
+   if it didn't need any changes and -1 on error, see debugedit_errmsg.
+   After an error FILE might be partially edited, unless the atomic
+   option is set.  */
+extern int debugedit_edit (debugedit *ctx, const char *file);
+
+/* Values for debugedit_check needs, what debugedit_edit would do.  */
+#define DEBUGEDIT_NEEDS_PATHS 1		/* Rewrite paths.  */
+#define DEBUGEDIT_NEEDS_BUILD_ID 2	/* Recompute the build ID.  */
+#define DEBUGEDIT_NEEDS_COMPRESS 4	/* (De)compress debug sections.  */
+
+/* The result of debugedit_check.  */
+struct debugedit_check
+{
+  /* The DEBUGEDIT_NEEDS bits for everything debugedit_edit would do.  */
+  unsigned int needs;
+  /* The size in bytes of all debug sections and of just the
+     .debug_info and .debug_types sections, which are the most work,
+     as stored in the file (all archive members together).  */
+  unsigned long long debug_size;
+  unsigned long long info_size;
+};
+
+/* Works out what debugedit_edit would do to FILE without writing to it,
+   or to the list file, and puts the result in *CHECK.  Returns 1 if
+   FILE would be written to, 0 if it would stay the same and -1 on
+   error, see debugedit_errmsg.  */
+extern int debugedit_check (debugedit *ctx, const char *file,
+			    struct debugedit_check *check);
+
+/* Returns the Nth build ID of the file last edited by debugedit_edit
+   and sets *SIZE to its size in bytes, or returns NULL if there is no
+   such build ID.  There is one for each ELF file (archive member) that
+   had a build ID note, when the build_id option is set.  */
+extern const unsigned char *debugedit_build_id (debugedit *ctx, size_t n,
+						size_t *size);
+
+/* Returns the error message of the last failed debugedit_edit call.  */
+extern const char *debugedit_errmsg (debugedit *ctx);
+
+/* Closes the list file and releases CTX.  */
+extern void debugedit_end (debugedit *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* libdebugedit.h */